@@ -1335,9 +1335,23 @@ char *FindFileName(const char *const fullPath)
 /***************************************************************************
 *                             INCLUDED FILES
 ***************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include "lzlocal.h"
 #include <PFAC.h>
-#include <assert.h>
+
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define BATCH_SIZE  32768   /* lookahead positions matched per PFAC call */
+
+/* encoder text: WINDOW_SIZE bytes of window, then a batch and its lookahead */
+#define TEXT_SIZE   (WINDOW_SIZE + BATCH_SIZE + MAX_CODED)
+
+#define HASH_SIZE   (2 * BATCH_SIZE)    /* trigram -> pattern ID table,
+                                           must be a power of two */
 
 /***************************************************************************
 *                            GLOBAL VARIABLES
@@ -1346,101 +1360,251 @@ char *FindFileName(const char *const fullPath)
 extern unsigned char slidingWindow[];
 extern unsigned char uncodedLookahead[];
 
+/* created once by InitializeSearchStructures, reused by every batch */
+static PFAC_handle_t handle;
+static char *patternText = NULL;        /* one pattern per line for PFAC */
+static int *h_matched_result = NULL;    /* pattern ID starting at each
+                                           text position, 0 for none */
+static int *chainPrev = NULL;           /* previous text position that
+                                           starts with the same pattern */
+static int *patternLast = NULL;         /* last position of each pattern */
+static unsigned long hashKey[HASH_SIZE];
+static int hashId[HASH_SIZE];
+
+/***************************************************************************
+*                               PROTOTYPES
+***************************************************************************/
+void FreeSearchStructures(void);
+
 /***************************************************************************
 *                                FUNCTIONS
 ***************************************************************************/
 
 /****************************************************************************
 *   Function   : InitializeSearchStructures
-*   Description: This function initializes structures used to speed up the
-*                process of mathcing uncoded strings to strings in the
-*                sliding window.  The brute force search doesn't use any
-*                special structures, so this function doesn't do anything.
+*   Description: This function creates the PFAC handle and allocates the
+*                host buffers used by every batch, so no PFAC or malloc
+*                calls are left on the per symbol path.
 *   Parameters : None
-*   Effects    : None
+*   Effects    : handle is created and the batch buffers are allocated
 *   Returned   : 0 for success, -1 for failure.  errno will be set in the
 *                event of a failure.
 ****************************************************************************/
 int InitializeSearchStructures(void)
 {
+    PFAC_status_t PFAC_status;
+
+    PFAC_status = PFAC_create( &handle ) ;
+    if ( PFAC_STATUS_SUCCESS != PFAC_status ){
+        printf("Error: fails to create PFAC handle, %s\n", PFAC_getErrorString(PFAC_status) );
+        return -1;
+    }
+
+    /* at most BATCH_SIZE patterns of MAX_UNCODED + 1 bytes and a '\n' */
+    patternText = (char *)malloc((MAX_UNCODED + 2) * BATCH_SIZE + 1);
+    h_matched_result = (int *)malloc(sizeof(int) * TEXT_SIZE);
+    chainPrev = (int *)malloc(sizeof(int) * TEXT_SIZE);
+    patternLast = (int *)malloc(sizeof(int) * (BATCH_SIZE + 1));
+
+    if ((NULL == patternText) || (NULL == h_matched_result) ||
+        (NULL == chainPrev) || (NULL == patternLast))
+    {
+        FreeSearchStructures();
+        errno = ENOMEM;
+        return -1;
+    }
+
     return 0;
 }
 
 /****************************************************************************
-*   Function   : FindMatch
-*   Description: This function will search through the slidingWindow
-*                dictionary for the longest sequence matching the MAX_CODED
-*                long string stored in uncodedLookahed.
-*   Parameters : windowHead - head of sliding window
-*                uncodedHead - head of uncoded lookahead buffer
+*   Function   : FreeSearchStructures
+*   Description: This function releases everything allocated by
+*                InitializeSearchStructures.
+*   Parameters : None
+*   Effects    : handle is destroyed and the batch buffers are freed
+*   Returned   : None
+****************************************************************************/
+void FreeSearchStructures(void)
+{
+    PFAC_destroy( handle ) ;
+
+    free(patternText);
+    free(h_matched_result);
+    free(chainPrev);
+    free(patternLast);
+    patternText = NULL;
+    h_matched_result = NULL;
+    chainPrev = NULL;
+    patternLast = NULL;
+}
+
+/****************************************************************************
+*   Function   : FindMatchesBatch
+*   Description: This function loads the MAX_UNCODED + 1 byte prefix of
+*                every lookahead string in text[start..end) as one PFAC
+*                pattern set, and runs a single PFAC_matchFromHost over the
+*                whole text (window, batch and trailing lookahead).  The
+*                result is chained so that FindMatchAt only has to visit
+*                window positions that start with the same prefix.
+*                Prefixes holding a '\n' or a NUL can't be written as a
+*                pattern line; FindMatchAt searches those positions itself.
+*   Parameters : text - window followed by the bytes to be encoded
+*                start - text index of the first position of the batch
+*                end - text index just past the last position of the batch
+*                textLen - number of valid bytes in text
+*   Effects    : h_matched_result, chainPrev and patternLast are rebuilt
+*   Returned   : 0 for success, -1 for failure.
+****************************************************************************/
+int FindMatchesBatch(const unsigned char *text, const unsigned int start,
+    const unsigned int end, const unsigned int textLen)
+{
+    PFAC_status_t PFAC_status;
+    unsigned long key;
+    unsigned int i, j, h;
+    int patterns;
+    char *p;
+
+    memset(hashId, 0, sizeof(hashId));
+    patterns = 0;
+    p = patternText;
+
+    for (i = start; (i < end) && (i + MAX_UNCODED + 1 <= textLen); i++)
+    {
+        key = 0;
+
+        for (j = 0; j <= MAX_UNCODED; j++)
+        {
+            if (('\n' == text[i + j]) || ('\0' == text[i + j]))
+            {
+                break;
+            }
+
+            key = (key << 8) | text[i + j];
+        }
+
+        if (j <= MAX_UNCODED)
+        {
+            continue;   /* not expressible as a pattern line */
+        }
+
+        for (h = (key * 2654435761UL) & (HASH_SIZE - 1);
+            (0 != hashId[h]) && (hashKey[h] != key);
+            h = (h + 1) & (HASH_SIZE - 1));
+
+        if (0 == hashId[h])
+        {
+            /* new prefix, PFAC numbers patterns by line starting at 1 */
+            hashKey[h] = key;
+            hashId[h] = ++patterns;
+            memcpy(p, text + i, MAX_UNCODED + 1);
+            p += MAX_UNCODED + 1;
+            *p++ = '\n';
+        }
+    }
+
+    *p = '\0';
+    memset(h_matched_result, 0, sizeof(int) * textLen);
+
+    if (patterns > 0)
+    {
+        PFAC_status = PFAC_readPattern( handle, patternText ) ;
+        if ( PFAC_STATUS_SUCCESS != PFAC_status ){
+            printf("Error: fails to read pattern from file, %s\n", PFAC_getErrorString(PFAC_status) );
+            return -1;
+        }
+
+        PFAC_status = PFAC_matchFromHost( handle, (char *)text, textLen, h_matched_result ) ;
+        if ( PFAC_STATUS_SUCCESS != PFAC_status ){
+            printf("Error: fails to PFAC_matchFromHost, %s\n", PFAC_getErrorString(PFAC_status) );
+            return -1;
+        }
+    }
+
+    /* chain every position to the previous one starting the same way */
+    for (i = 0; i <= (unsigned int)patterns; i++)
+    {
+        patternLast[i] = -1;
+    }
+
+    for (i = 0; i < textLen; i++)
+    {
+        if (0 != h_matched_result[i])
+        {
+            chainPrev[i] = patternLast[h_matched_result[i]];
+            patternLast[h_matched_result[i]] = i;
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : FindMatchAt
+*   Description: This function finds the longest string in the window
+*                before text[pos] that matches the string starting at
+*                text[pos].  Candidates come from the chains built by
+*                FindMatchesBatch, or from a plain scan of the window if
+*                the prefix at pos wasn't sent to PFAC.  The match has to
+*                end before pos, because DecodeLZSS copies it out of the
+*                sliding window as it was before the code was read.
+*   Parameters : text - buffer passed to FindMatchesBatch
+*                pos - text index of the first uncoded byte
+*                textHead - sliding window index of text[0]
+*                len - number of uncoded bytes left from pos
 *   Effects    : None
 *   Returned   : The sliding window index where the match starts and the
 *                length of the match.  If there is no match a length of
 *                zero will be returned.
 ****************************************************************************/
-encoded_string_t FindMatch(const unsigned int windowHead,
-    unsigned int uncodedHead)
+encoded_string_t FindMatchAt(const unsigned char *text, const unsigned int pos,
+    const unsigned int textHead, const unsigned int len)
 {
     encoded_string_t matchData;
-    unsigned int i;
-    unsigned int j;
+    unsigned int j, limit;
+    int i, lower;
 
     matchData.length = 0;
     matchData.offset = 0;
-    i = windowHead;  /* start at the beginning of the sliding window */
-    //j = 0;
+    lower = (int)pos - WINDOW_SIZE;
 
-    PFAC_handle_t handle ;
-    PFAC_status_t PFAC_status ;
-    int input_size = strlen((char *)slidingWindow);    
-    char *h_inputString = NULL ;
-    int  *h_matched_result = NULL ;
+    if (lower < 0)
+    {
+        lower = 0;
+    }
 
-    // step 1: create PFAC handle 
-    PFAC_status = PFAC_create( &handle ) ;
-	//handle->textureMode = PFAC_TEXTURE_OFF; 
-    assert( PFAC_STATUS_SUCCESS == PFAC_status );
-    
-    // step 2: read patterns and dump transition table 
-    PFAC_status = PFAC_readPattern( handle, (char *)uncodedLookahead) ;
-    if ( PFAC_STATUS_SUCCESS != PFAC_status ){
-        printf("Error: fails to read pattern from file, %s\n", PFAC_getErrorString(PFAC_status) );
-        exit(1) ;	
-    }
-    
-    // allocate memory to contain the whole file
-    h_inputString = (char *) malloc (sizeof(char)*input_size);
-    assert( NULL != h_inputString );
- 
-    h_matched_result = (int *) malloc (sizeof(int)*input_size);
-    assert( NULL != h_matched_result );
-    memset( h_matched_result, 0, sizeof(int)*input_size ) ;
-     
-    // copy the file into the buffer
-    strcpy(h_inputString, (char *)slidingWindow);
-    
-    // step 4: run PFAC on GPU           
-    PFAC_status = PFAC_matchFromHost( handle, h_inputString, input_size, h_matched_result ) ;
-    if ( PFAC_STATUS_SUCCESS != PFAC_status ){
-        printf("Error: fails to PFAC_matchFromHost, %s\n", PFAC_getErrorString(PFAC_status) );
-        exit(1) ;	
-    }     
-
-    // step 5: output matched result
-    for (i = 0; i < input_size; i++) {
-        if (h_matched_result[i] != 0) {
-            if(h_matched_result[i] > matchData.length){
-        		matchData.length = h_matched_result[i];
-    			matchData.offset = windowHead-h_matched_result[i];
+    i = (0 != h_matched_result[pos]) ? chainPrev[pos] :
+        (int)pos - (MAX_UNCODED + 1);
+
+    while (i >= lower)
+    {
+        limit = pos - i;
+
+        if (limit > MAX_CODED)
+        {
+            limit = MAX_CODED;
+        }
+
+        if (limit > len)
+        {
+            limit = len;
+        }
+
+        for (j = 0; (j < limit) && (text[i + j] == text[pos + j]); j++);
+
+        if (j > matchData.length)
+        {
+            matchData.length = j;
+            matchData.offset = (textHead + i) % WINDOW_SIZE;
+
+            if (j >= MAX_CODED)
+            {
+                break;
             }
         }
-    }
 
-    PFAC_status = PFAC_destroy( handle ) ;
-    assert( PFAC_STATUS_SUCCESS == PFAC_status );
-    
-    free(h_inputString);
-    free(h_matched_result); 
+        i = (0 != h_matched_result[pos]) ? chainPrev[i] : i - 1;
+    }
 
     return matchData;
 }
@@ -1473,15 +1637,39 @@ int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
 #include <string.h>
 #include <errno.h>
 #include "lzlocal.h"
-#include "bitfile.h"
 
 /***************************************************************************
-*                            TYPE DEFINITIONS
+*                                CONSTANTS
 ***************************************************************************/
+#define BIT_BLOCK   65536   /* bytes of code moved per fwrite/fread call */
 
 /***************************************************************************
-*                                CONSTANTS
+*                            TYPE DEFINITIONS
+***************************************************************************/
+/***************************************************************************
+* Bits are kept msb first in a 64 bit word.  The writer moves them into
+* block 32 at a time and the reader refills the word from block 32 at a
+* time, so only whole blocks reach stdio.  The bit stream is the one
+* BitFile writes on a little endian machine.
 ***************************************************************************/
+typedef struct
+{
+    FILE *fp;                       /* file the blocks are written to */
+    unsigned long long bits;        /* pending bits are its count lsbs */
+    unsigned int count;             /* number of pending bits (< 32) */
+    unsigned int used;              /* bytes waiting in block */
+    unsigned char block[BIT_BLOCK];
+} bit_writer_t;
+
+typedef struct
+{
+    FILE *fp;                       /* file the blocks are read from */
+    unsigned long long bits;        /* unread bits are its count lsbs */
+    unsigned int count;             /* number of unread bits */
+    unsigned int pos;               /* next unread byte in block */
+    unsigned int len;               /* valid bytes in block */
+    unsigned char block[BIT_BLOCK];
+} bit_reader_t;
 
 /***************************************************************************
 *                            GLOBAL VARIABLES
@@ -1490,6 +1678,12 @@ int ReplaceChar(const unsigned int charIndex, const unsigned char replacement)
 unsigned char slidingWindow[WINDOW_SIZE];
 unsigned char uncodedLookahead[MAX_CODED];
 
+/* window followed by the batch being encoded and its lookahead */
+static unsigned char encoderText[TEXT_SIZE];
+
+static bit_writer_t writer;
+static bit_reader_t reader;
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
@@ -1498,12 +1692,203 @@ unsigned char uncodedLookahead[MAX_CODED];
 *                                FUNCTIONS
 ***************************************************************************/
 
+/****************************************************************************
+*   Function   : WriterPutBits
+*   Description: This function appends the count lsbs of value to the
+*                bits pending in a bit_writer_t.  Once 32 bits are pending
+*                they are moved into the block, and a full block is written
+*                to the file.
+*   Parameters : bw - pointer to the bit writer
+*                value - bits to write, msb first
+*                count - number of bits to write (<= 32)
+*   Effects    : Bits are buffered and whole blocks written out.
+*   Returned   : 0 for success, -1 if the file couldn't be written.
+****************************************************************************/
+static int WriterPutBits(bit_writer_t *bw, const unsigned int value,
+    const unsigned int count)
+{
+    unsigned int word;
+
+    bw->bits = (bw->bits << count) | value;
+    bw->count += count;
+
+    if (bw->count >= 32)
+    {
+        bw->count -= 32;
+        word = (unsigned int)(bw->bits >> bw->count);
+
+        bw->block[bw->used] = word >> 24;
+        bw->block[bw->used + 1] = word >> 16;
+        bw->block[bw->used + 2] = word >> 8;
+        bw->block[bw->used + 3] = word;
+        bw->used += 4;
+
+        if (BIT_BLOCK == bw->used)
+        {
+            bw->used = 0;
+
+            if (fwrite(bw->block, 1, BIT_BLOCK, bw->fp) != BIT_BLOCK)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : WriterPutNum
+*   Description: This function writes the count lsbs of an unsigned int the
+*                way BitFilePutBitsNum does on a little endian machine:
+*                whole bytes first, lowest first, then the bits that are
+*                left over.
+*   Parameters : bw - pointer to the bit writer
+*                value - number to write
+*                count - number of bits to write
+*   Effects    : Bits are buffered and whole blocks written out.
+*   Returned   : 0 for success, -1 if the file couldn't be written.
+****************************************************************************/
+static int WriterPutNum(bit_writer_t *bw, const unsigned int value,
+    const unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        if (0 != WriterPutBits(bw, (value >> i) & 0xFF, 8))
+        {
+            return -1;
+        }
+    }
+
+    if (i < count)
+    {
+        return WriterPutBits(bw, (value >> i) & ((1U << (count - i)) - 1),
+            count - i);
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : WriterFlush
+*   Description: This function pads the pending bits with 0s to a whole
+*                byte, as BitFileToFILE does, and writes out what is left
+*                of the block.
+*   Parameters : bw - pointer to the bit writer
+*   Effects    : Everything buffered is written to the file.
+*   Returned   : 0 for success, -1 if the file couldn't be written.
+****************************************************************************/
+static int WriterFlush(bit_writer_t *bw)
+{
+    while (bw->count > 0)
+    {
+        if (bw->count < 8)
+        {
+            bw->bits <<= 8 - bw->count;
+            bw->count = 8;
+        }
+
+        bw->count -= 8;
+        bw->block[bw->used++] = (unsigned char)(bw->bits >> bw->count);
+    }
+
+    if (fwrite(bw->block, 1, bw->used, bw->fp) != bw->used)
+    {
+        return -1;
+    }
+
+    bw->used = 0;
+    return 0;
+}
+
+/****************************************************************************
+*   Function   : ReaderGetBits
+*   Description: This function returns the next count bits of a
+*                bit_reader_t, refilling its word from the block (4 bytes
+*                at a time while there are that many) and the block from
+*                the file as they run out.
+*   Parameters : br - pointer to the bit reader
+*                count - number of bits to read (<= 32)
+*   Effects    : Bits are consumed and blocks read as needed.
+*   Returned   : The bits read, msb first, or EOF if the file ends first.
+****************************************************************************/
+static int ReaderGetBits(bit_reader_t *br, const unsigned int count)
+{
+    while (br->count < count)
+    {
+        if (br->pos == br->len)
+        {
+            br->len = fread(br->block, 1, BIT_BLOCK, br->fp);
+            br->pos = 0;
+
+            if (0 == br->len)
+            {
+                return EOF;
+            }
+        }
+
+        if ((br->count <= 32) && (br->pos + 4 <= br->len))
+        {
+            br->bits = (br->bits << 32) |
+                ((unsigned int)br->block[br->pos] << 24) |
+                ((unsigned int)br->block[br->pos + 1] << 16) |
+                ((unsigned int)br->block[br->pos + 2] << 8) |
+                br->block[br->pos + 3];
+            br->pos += 4;
+            br->count += 32;
+        }
+        else
+        {
+            br->bits = (br->bits << 8) | br->block[br->pos++];
+            br->count += 8;
+        }
+    }
+
+    br->count -= count;
+    return (int)((br->bits >> br->count) & ((1ULL << count) - 1));
+}
+
+/****************************************************************************
+*   Function   : ReaderGetNum
+*   Description: This function reads a number written by WriterPutNum.
+*   Parameters : br - pointer to the bit reader
+*                value - where the number goes
+*                count - number of bits to read
+*   Effects    : Bits are consumed and blocks read as needed.
+*   Returned   : 0 for success, EOF if the file ends first.
+****************************************************************************/
+static int ReaderGetNum(bit_reader_t *br, unsigned int *value,
+    const unsigned int count)
+{
+    unsigned int i;
+    int c;
+
+    *value = 0;
+
+    for (i = 0; i < count; i += 8)
+    {
+        c = ReaderGetBits(br, (count - i < 8) ? count - i : 8);
+
+        if (EOF == c)
+        {
+            return EOF;
+        }
+
+        *value |= (unsigned int)c << i;
+    }
+
+    return 0;
+}
+
 /****************************************************************************
 *   Function   : EncodeLZSS
 *   Description: This function will read an input file and write an output
 *                file encoded according to the traditional LZSS algorithm.
 *                This algorithm encodes strings as 16 bits (a 12 bit offset
-*                + a 4 bit length).
+*                + a 4 bit length).  Input is read BATCH_SIZE bytes at a
+*                time and each batch is matched with one PFAC call.
 *   Parameters : fpIn - pointer to the open binary file to encode
 *                fpOut - pointer to the open binary file to write encoded
 *                       output
@@ -1514,14 +1899,13 @@ unsigned char uncodedLookahead[MAX_CODED];
 ****************************************************************************/
 int EncodeLZSS(FILE *fpIn, FILE *fpOut)
 {
-    bit_file_t *bfpOut;
     encoded_string_t matchData;
-    int c;
     unsigned int i;
-    unsigned int len;                       /* length of string */
-
-    /* head of sliding window and lookahead */
-    unsigned int windowHead, uncodedHead;
+    int status;                             /* of the last call, 0 or -1 */
+    unsigned int pos;                       /* next uncoded byte in text */
+    unsigned int textLen;                   /* valid bytes in encoderText */
+    unsigned int batchEnd;                  /* end of the current batch */
+    unsigned int textHead;                  /* window index of text[0] */
 
     /* validate arguments */
     if ((NULL == fpIn) || (NULL == fpOut))
@@ -1530,114 +1914,121 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
-    /* convert output file to bitfile */
-    bfpOut = MakeBitFile(fpOut, BF_WRITE);
-
-    if (NULL == bfpOut)
-    {
-        perror("Making Output File a BitFile");
-        return -1;
-    }
-
-    windowHead = 0;
-    uncodedHead = 0;
+    /* codes are buffered in writer */
+    writer.fp = fpOut;
+    writer.bits = 0;
+    writer.count = 0;
+    writer.used = 0;
 
     /************************************************************************
-    * Fill the sliding window buffer with some known vales.  DecodeLZSS must
-    * use the same values.  If common characters are used, there's an
-    * increased chance of matching to the earlier strings.
+    * The first WINDOW_SIZE bytes of encoderText are the sliding window,
+    * filled with some known vales.  DecodeLZSS must use the same values.
+    * If common characters are used, there's an increased chance of
+    * matching to the earlier strings.
     ************************************************************************/
-    memset(slidingWindow, ' ', WINDOW_SIZE * sizeof(unsigned char));
+    memset(encoderText, ' ', WINDOW_SIZE * sizeof(unsigned char));
+    textHead = 0;
+    pos = WINDOW_SIZE;
 
-    /************************************************************************
-    * Copy MAX_CODED bytes from the input file into the uncoded lookahead
-    * buffer.
-    ************************************************************************/
-    for (len = 0; len < MAX_CODED && (c = getc(fpIn)) != EOF; len++)
-    {
-        uncodedLookahead[len] = c;
-    }
+    /* then the first batch and its lookahead */
+    textLen = WINDOW_SIZE +
+        fread(encoderText + WINDOW_SIZE, 1, TEXT_SIZE - WINDOW_SIZE, fpIn);
 
-    if (0 == len)
+    if (WINDOW_SIZE == textLen)
     {
         return 0;   /* inFile was empty */
     }
 
-    /* Look for matching string in sliding window */
-    i = InitializeSearchStructures();
+    /* create the PFAC handle and batch buffers */
+    status = InitializeSearchStructures();
 
-    if (0 != i)
+    if (0 != status)
     {
-        return i;       /* InitializeSearchStructures returned an error */
+        return status;  /* InitializeSearchStructures returned an error */
     }
 
-    matchData = FindMatch(windowHead, uncodedHead);
-
     /* now encoded the rest of the file until an EOF is read */
-    while (len > 0)
+    while (pos < textLen)
     {
-        if (matchData.length > len)
+        batchEnd = pos + BATCH_SIZE;
+
+        if (batchEnd > textLen)
         {
-            /* garbage beyond last data happened to extend match length */
-            matchData.length = len;
+            batchEnd = textLen;
         }
 
-        if (matchData.length <= MAX_UNCODED)
+        if (0 != FindMatchesBatch(encoderText, pos, batchEnd, textLen))
         {
-            /* not long enough match.  write uncoded flag and character */
-            BitFilePutBit(UNCODED, bfpOut);
-            BitFilePutChar(uncodedLookahead[uncodedHead], bfpOut);
-
-            matchData.length = 1;   /* set to 1 for 1 byte uncoded */
+            FreeSearchStructures();
+            return -1;
         }
-        else
+
+        while (pos < batchEnd)
         {
-            unsigned int adjustedLen;
+            matchData = FindMatchAt(encoderText, pos, textHead,
+                textLen - pos);
+
+            if (matchData.length <= MAX_UNCODED)
+            {
+                /* not long enough match.  write uncoded flag and character */
+                status = WriterPutBits(&writer,
+                    (UNCODED << 8) | encoderText[pos], 9);
+
+                matchData.length = 1;   /* set to 1 for 1 byte uncoded */
+            }
+            else
+            {
+                unsigned int adjustedLen;
+
+                /* adjust the length of the match so minimun encoded len is 0*/
+                adjustedLen = matchData.length - (MAX_UNCODED + 1);
+
+                /* match length > MAX_UNCODED.  Encode as offset and length. */
+                status = WriterPutBits(&writer, ENCODED, 1);
+
+                if (0 == status)
+                {
+                    status = WriterPutNum(&writer, matchData.offset,
+                        OFFSET_BITS);
+                }
+
+                if (0 == status)
+                {
+                    status = WriterPutNum(&writer, adjustedLen, LENGTH_BITS);
+                }
+            }
 
-            /* adjust the length of the match so minimun encoded len is 0*/
-            adjustedLen = matchData.length - (MAX_UNCODED + 1);
+            if (0 != status)
+            {
+                perror("Writing Output File");
+                FreeSearchStructures();
+                return -1;
+            }
 
-            /* match length > MAX_UNCODED.  Encode as offset and length. */
-            BitFilePutBit(ENCODED, bfpOut);
-            BitFilePutBitsNum(bfpOut, &matchData.offset, OFFSET_BITS,
-                sizeof(unsigned int));
-            BitFilePutBitsNum(bfpOut, &adjustedLen, LENGTH_BITS,
-                sizeof(unsigned int));
+            pos += matchData.length;
         }
 
         /********************************************************************
-        * Replace the matchData.length worth of bytes we've matched in the
-        * sliding window with new bytes from the input file.
+        * Slide: the WINDOW_SIZE bytes before pos become the new window and
+        * the space freed behind the lookahead is refilled from the file.
         ********************************************************************/
-        i = 0;
-        while ((i < matchData.length) && ((c = getc(fpIn)) != EOF))
-        {
-            /* add old byte into sliding window and new into lookahead */
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            uncodedLookahead[uncodedHead] = c;
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
-            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            i++;
-        }
+        i = pos - WINDOW_SIZE;
+        memmove(encoderText, encoderText + i, textLen - i);
+        textLen -= i;
+        textHead = (textHead + i) % WINDOW_SIZE;
+        pos = WINDOW_SIZE;
+        textLen += fread(encoderText + textLen, 1, TEXT_SIZE - textLen, fpIn);
+    }
 
-        /* handle case where we hit EOF before filling lookahead */
-        while (i < matchData.length)
-        {
-            ReplaceChar(windowHead, uncodedLookahead[uncodedHead]);
-            /* nothing to add to lookahead here */
-            windowHead = Wrap((windowHead + 1), WINDOW_SIZE);
-            uncodedHead = Wrap((uncodedHead + 1), MAX_CODED);
-            len--;
-            i++;
-        }
+    FreeSearchStructures();
 
-        /* find match for the remaining characters */
-        matchData = FindMatch(windowHead, uncodedHead);
+    /* we've encoded everything, write out what is left in writer */
+    if (0 != WriterFlush(&writer))
+    {
+        perror("Writing Output File");
+        return -1;
     }
 
-    /* we've encoded everything, free bitfile structure */
-    BitFileToFILE(bfpOut);
-
    return 0;
 }
 
@@ -1656,7 +2047,6 @@ int EncodeLZSS(FILE *fpIn, FILE *fpOut)
 ****************************************************************************/
 int DecodeLZSS(FILE *fpIn, FILE *fpOut)
 {
-    bit_file_t *bfpIn;
     int c;
     unsigned int i, nextChar;
     encoded_string_t code;              /* offset/length code for string */
@@ -1668,14 +2058,12 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         return -1;
     }
 
-    /* convert input file to bitfile */
-    bfpIn = MakeBitFile(fpIn, BF_READ);
-
-    if (NULL == bfpIn)
-    {
-        perror("Making Input File a BitFile");
-        return -1;
-    }
+    /* codes are read a block at a time through reader */
+    reader.fp = fpIn;
+    reader.bits = 0;
+    reader.count = 0;
+    reader.pos = 0;
+    reader.len = 0;
 
     /************************************************************************
     * Fill the sliding window buffer with some known vales.  EncodeLZSS must
@@ -1688,7 +2076,7 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
 
     while (1)
     {
-        if ((c = BitFileGetBit(bfpIn)) == EOF)
+        if ((c = ReaderGetBits(&reader, 1)) == EOF)
         {
             /* we hit the EOF */
             break;
@@ -1697,7 +2085,7 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         if (c == UNCODED)
         {
             /* uncoded character */
-            if ((c = BitFileGetChar(bfpIn)) == EOF)
+            if ((c = ReaderGetBits(&reader, 8)) == EOF)
             {
                 break;
             }
@@ -1713,14 +2101,12 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
             code.offset = 0;
             code.length = 0;
 
-            if ((BitFileGetBitsNum(bfpIn, &code.offset, OFFSET_BITS,
-                sizeof(unsigned int))) == EOF)
+            if (ReaderGetNum(&reader, &code.offset, OFFSET_BITS) == EOF)
             {
                 break;
             }
 
-            if ((BitFileGetBitsNum(bfpIn, &code.length, LENGTH_BITS,
-                sizeof(unsigned int))) == EOF)
+            if (ReaderGetNum(&reader, &code.length, LENGTH_BITS) == EOF)
             {
                 break;
             }
@@ -1751,9 +2137,6 @@ int DecodeLZSS(FILE *fpIn, FILE *fpOut)
         }
     }
 
-    /* we've decoded everything, free bitfile structure */
-    BitFileToFILE(bfpIn);
-
     return 0;
 }
 
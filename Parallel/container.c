@@ -0,0 +1,389 @@
+/* C file that implements the container functions specified in container.h */
+
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "container.h"
+#include "pool.h"
+
+static const unsigned int crc_table[256] = {
+	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+	0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+	0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+	0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+	0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+
+/* CRC-32 (the zlib/PNG one) of n bytes of buf, continuing from crc */
+
+unsigned int checksum(unsigned int crc, const void *buf, size_t n){
+	const unsigned char *p = (const unsigned char *) buf;
+	crc = ~crc;
+	while(n--){
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+
+/* little endian encoding of the header and table fields */
+
+static void put32(unsigned char *p, unsigned int v){
+	p[0] = v;  p[1] = v >> 8;  p[2] = v >> 16;  p[3] = v >> 24;
+}
+
+static void put64(unsigned char *p, unsigned long long v){
+	put32(p, (unsigned int) v);  put32(p + 4, (unsigned int) (v >> 32));
+}
+
+static unsigned int get32(const unsigned char *p){
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static unsigned long long get64(const unsigned char *p){
+	return get32(p) | (unsigned long long) get32(p + 4) << 32;
+}
+
+static void writeHeader(unsigned char *h, Container *c, unsigned long long table){
+	memset(h, 0, CONTAINER_HEADER_SIZE);
+	memcpy(h, CONTAINER_MAGIC, 4);
+	h[4] = CONTAINER_VERSION;
+	h[6] = c->flags;  h[7] = c->flags >> 8;
+	put32(h + 8, c->chunks);
+	put64(h + 16, table);
+	put64(h + 24, c->size);
+}
+
+
+/* Start a container of chunks chunks on fp */
+
+int containerCreate(Container *c, FILE *fp, unsigned int chunks){
+	unsigned char h[CONTAINER_HEADER_SIZE];
+
+	c->fp = fp;
+	c->flags = 0;
+	c->chunks = chunks;
+	c->size = 0;
+	c->next = CONTAINER_HEADER_SIZE;
+	c->start = NULL;
+	c->table = (ChunkEntry *) calloc(chunks ? chunks : 1, sizeof(ChunkEntry));
+	if (c->table == NULL) return -1;
+
+	writeHeader(h, c, 0);  /* table offset 0 marks an unfinished container */
+	if (fseeko(fp, 0, SEEK_SET) != 0 || fwrite(h, 1, sizeof(h), fp) != sizeof(h)) return -1;
+	return 0;
+}
+
+
+/* Append the code of chunk index to the container and record it in the table */
+
+int containerWriteChunk(Container *c, unsigned int index, const void *code,
+		unsigned int csize, unsigned int usize, unsigned int crc){
+	if (index >= c->chunks) return -1;
+	if (fseeko(c->fp, c->next, SEEK_SET) != 0
+			|| fwrite(code, 1, csize, c->fp) != csize) return -1;
+
+	c->table[index].offset = c->next;
+	c->table[index].csize = csize;
+	c->table[index].usize = usize;
+	c->table[index].crc = crc;
+	c->table[index].flags = 0;
+	c->next += csize;
+	c->size += usize;
+	return 0;
+}
+
+
+/* Make room for more chunks after the old table, which stays valid until the
+header points past it */
+
+int containerAppend(Container *c, unsigned int more){
+	ChunkEntry *table;
+
+	table = (ChunkEntry *) realloc(c->table, sizeof(ChunkEntry) * (c->chunks + more + 1));
+	if (table == NULL) return -1;
+	memset(table + c->chunks, 0, sizeof(ChunkEntry) * (more + 1));
+	c->table = table;
+	free(c->start);  /* no longer adds up */
+	c->start = NULL;
+	c->next += (unsigned long long) c->chunks * CONTAINER_ENTRY_SIZE;
+	c->chunks += more;
+	return 0;
+}
+
+
+/* Write the chunk table and the header */
+
+int containerFinish(Container *c){
+	unsigned char h[CONTAINER_HEADER_SIZE], e[CONTAINER_ENTRY_SIZE];
+	unsigned int i;
+	int status = 0;
+
+	if (fseeko(c->fp, c->next, SEEK_SET) != 0) status = -1;
+	for (i = 0; status == 0 && i < c->chunks; i++) {
+		put64(e, c->table[i].offset);
+		put32(e + 8, c->table[i].csize);
+		put32(e + 12, c->table[i].usize);
+		put32(e + 16, c->table[i].crc);
+		put32(e + 20, c->table[i].flags);
+		if (fwrite(e, 1, sizeof(e), c->fp) != sizeof(e)) status = -1;
+	}
+
+	writeHeader(h, c, c->next);
+	if (status == 0 && (fseeko(c->fp, 0, SEEK_SET) != 0
+			|| fwrite(h, 1, sizeof(h), c->fp) != sizeof(h)
+			|| fflush(c->fp) != 0)) status = -1;
+
+	containerClose(c);
+	return status;
+}
+
+
+/* Read the header and the chunk table of the container on fp */
+
+int containerOpen(Container *c, FILE *fp){
+	unsigned char h[CONTAINER_HEADER_SIZE], e[CONTAINER_ENTRY_SIZE];
+	unsigned long long table;
+	unsigned int i;
+
+	c->fp = fp;
+	c->table = NULL;
+	c->start = NULL;
+	if (fseeko(fp, 0, SEEK_SET) != 0 || fread(h, 1, sizeof(h), fp) != sizeof(h)
+			|| memcmp(h, CONTAINER_MAGIC, 4) != 0 || h[4] != CONTAINER_VERSION) return -1;
+
+	c->flags = h[6] | h[7] << 8;
+	c->chunks = get32(h + 8);
+	table = get64(h + 16);
+	c->size = get64(h + 24);
+	c->next = table;
+	if (table < CONTAINER_HEADER_SIZE) return -1;  /* never finished */
+
+	c->table = (ChunkEntry *) calloc(c->chunks ? c->chunks : 1, sizeof(ChunkEntry));
+	c->start = (unsigned long long *) malloc(sizeof(unsigned long long) * (c->chunks + 1));
+	if (c->table == NULL || c->start == NULL || fseeko(fp, table, SEEK_SET) != 0) {
+		containerClose(c);
+		return -1;
+	}
+	for (i = 0; i < c->chunks; i++) {
+		if (fread(e, 1, sizeof(e), fp) != sizeof(e)) {
+			containerClose(c);
+			return -1;
+		}
+		c->table[i].offset = get64(e);
+		c->table[i].csize = get32(e + 8);
+		c->table[i].usize = get32(e + 12);
+		c->table[i].crc = get32(e + 16);
+		c->table[i].flags = get32(e + 20);
+	}
+	c->start[0] = 0;
+	for (i = 0; i < c->chunks; i++) c->start[i + 1] = c->start[i] + c->table[i].usize;
+	if (c->start[c->chunks] != c->size) {  /* the chunks don't make up the text */
+		containerClose(c);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Binary search of the chunk starts. Empty chunks start where the next one
+does, so the one found never is. */
+
+unsigned int containerFindChunk(const Container *c, unsigned long long offset){
+	unsigned int lo = 0, hi = c->chunks, mid;
+
+	if (offset >= c->size) return c->chunks;
+	while (hi - lo > 1) {  /* start[lo] <= offset < start[hi] */
+		mid = lo + (hi - lo) / 2;
+		if (c->start[mid] <= offset) lo = mid;
+		else hi = mid;
+	}
+	return lo;
+}
+
+
+/* Read the code of chunk index into code. pread() keeps this safe for threads
+since it doesn't move the file position shared through fp. */
+
+int containerReadChunk(Container *c, unsigned int index, void *code){
+	size_t done = 0;
+	ssize_t n;
+
+	if (index >= c->chunks) return -1;
+	while (done < c->table[index].csize) {
+		n = pread(fileno(c->fp), (char *) code + done, c->table[index].csize - done,
+				(off_t) (c->table[index].offset + done));
+		if (n <= 0) return -1;
+		done += n;
+	}
+	return 0;
+}
+
+
+/* containerDecodeAll() hands one chunk to each task */
+
+#define PRIMED_DICT	(1 << 30)	/* of the text before a CHUNK_PRIMED chunk,
+					   at least as much as any window holds */
+#define PRIMED_WINDOW	(1 << 20)	/* the widest window (CONTAINER_FORMAT_1M) */
+
+typedef struct {
+	Container *c;
+	unsigned char *out;			/* the text of chunks first .. */
+	unsigned int first;
+	unsigned long long base;		/* c->start[first] */
+	ChunkDecoder decode;
+	PrimedDecoder primed;			/* NULL if CHUNK_PRIMED chunks are damaged */
+	int pass;				/* 1 once the others are done */
+	unsigned int bad;			/* first damaged chunk, c->chunks if none */
+	pthread_mutex_t lock;
+} DecodeJob;
+
+static void decodeTask(void *arg, int index, int worker){
+	DecodeJob *job = (DecodeJob *) arg;
+	unsigned long long before;	/* bytes of out in front of the chunk */
+	ChunkEntry *e;
+	unsigned char *code, *text;
+	int len = -1;
+
+	(void) worker;
+	index += job->first;
+	e = &job->c->table[index];
+	before = job->c->start[index] - job->base;
+	text = job->out + before;
+	if ((e->flags & CHUNK_PRIMED) && job->primed != NULL && job->pass == 0)
+		return;  /* once the text before it is there */
+	if (e->flags & CHUNK_STORED) {	/* read straight into its place */
+		if (e->csize == e->usize && containerReadChunk(job->c, index, text) == 0)
+			len = (int) e->usize;
+		code = NULL;
+	} else if ((code = (unsigned char *) poolTake(e->csize + 1)) != NULL
+			&& containerReadChunk(job->c, index, code) == 0) {
+		if (!(e->flags & CHUNK_PRIMED)) len = job->decode(code, e->csize, text, e->usize);
+		else if (job->primed != NULL) {
+			int back = before < PRIMED_DICT ? (int) before : PRIMED_DICT;
+			len = job->primed(text - back, back, code, e->csize, text, e->usize);
+		}
+	}
+	poolGive(code);
+	if (len != (int) e->usize || checksum(0, text, len) != e->crc) {
+		pthread_mutex_lock(&job->lock);
+		if ((unsigned int) index < job->bad) job->bad = index;
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+/* chunks first .. last - 1 into out, then each primed one after the ones
+before it */
+
+static int decodeChunks(Container *c, unsigned int first, unsigned int last,
+		unsigned char *out, int threads, ChunkDecoder decode, PrimedDecoder primed,
+		unsigned int *bad){
+	DecodeJob job;
+	unsigned int i;
+	int result;
+
+	job.c = c;  job.out = out;  job.first = first;  job.base = c->start[first];
+	job.decode = decode;  job.primed = primed;  job.pass = 0;  job.bad = c->chunks;
+	pthread_mutex_init(&job.lock, NULL);
+	result = poolRun(threads, (int) (last - first), decodeTask, &job);
+	job.pass = 1;	/* each primed chunk after the one before it */
+	for (i = first; primed != NULL && i < last; i++)
+		if (c->table[i].flags & CHUNK_PRIMED) decodeTask(&job, (int) (i - first), 0);
+	pthread_mutex_destroy(&job.lock);
+	if (bad != NULL) *bad = job.bad;
+	return result != 0 || job.bad != c->chunks ? -1 : 0;
+}
+
+int containerDecodeAll(Container *c, unsigned char *out, int threads,
+		ChunkDecoder decode, unsigned int *bad){
+	return containerDecodeAllPrimed(c, out, threads, decode, NULL, bad);
+}
+
+int containerDecodeAllPrimed(Container *c, unsigned char *out, int threads,
+		ChunkDecoder decode, PrimedDecoder primed, unsigned int *bad){
+	if (bad != NULL) *bad = c->chunks;
+	if (c->start == NULL) return -1;
+	return decodeChunks(c, 0, c->chunks, out, threads, decode, primed, bad);
+}
+
+
+/* Only the chunks holding offset .. offset + len - 1, and those a primed one
+among them takes its window from, decoded on their own and copied out of */
+
+int containerDecodeRange(Container *c, unsigned long long offset, size_t len,
+		unsigned char *out, int threads, ChunkDecoder decode, PrimedDecoder primed,
+		unsigned int *bad){
+	unsigned int first, last, i;
+	unsigned char *text;
+	int result;
+
+	if (bad != NULL) *bad = c->chunks;
+	if (c->start == NULL || offset > c->size || len > c->size - offset) return -1;
+	if (len == 0) return 0;
+	first = containerFindChunk(c, offset);
+	last = containerFindChunk(c, offset + len - 1) + 1;
+	for (i = last; i-- > first; )	/* first moves down as they need it */
+		while ((c->table[i].flags & CHUNK_PRIMED) && first > 0
+				&& c->start[i] - c->start[first] < PRIMED_WINDOW) first--;
+
+	text = (unsigned char *) poolTake(c->start[last] - c->start[first] + 1);
+	if (text == NULL) return -1;
+	result = decodeChunks(c, first, last, text, threads, decode, primed, bad);
+	if (result == 0) memcpy(out, text + (offset - c->start[first]), len);
+	poolGive(text);
+	return result;
+}
+
+
+/* Free the chunk table of a container opened with containerOpen() */
+
+void containerClose(Container *c){
+	free(c->table);
+	free(c->start);
+	c->table = NULL;
+	c->start = NULL;
+}
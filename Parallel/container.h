@@ -0,0 +1,152 @@
+/* Header file for the single file container written by the parallel encoders
+Include this file in your code and link container.c and pool.c (with -pthread)
+if you want to read or write compressed files.
+
+A container is one header, the code of every chunk, and a chunk table:
+
+	offset 0	"FLZS", version, format flags, number of chunks,
+			offset of the chunk table, total uncompressed size
+	offset 32	code of the chunks, in the order they were written
+	table offset	one ChunkEntry per chunk, in input order
+
+All numbers are little endian. Because every chunk is found through the table,
+chunks can be written in whatever order they finish and decoding can start at
+any chunk (but a CHUNK_PRIMED one needs the text of the chunks before it).
+
+containerAppend() adds chunks to a finished container. Their code goes after
+the old table, and the new table after that. The old chunks stay where they
+are, and the header, written last, is what switches to the new table.
+*/
+
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CONTAINER_MAGIC		"FLZS"
+#define CONTAINER_VERSION	1
+#define CONTAINER_HEADER_SIZE	32
+#define CONTAINER_ENTRY_SIZE	24
+
+/* The low byte of the header's format flags says how the chunks are coded. Only
+lzsspa writes (and decodes) anything but CONTAINER_FORMAT_4K. */
+#define CONTAINER_FORMAT(flags)	((flags) & 0xff)
+#define CONTAINER_FORMAT_4K	0	/* N = 4096, F = 18: Okumura's 2 byte pairs */
+#define CONTAINER_FORMAT_64K	1	/* N = 64 KB, F = 259, 3 byte pairs */
+#define CONTAINER_FORMAT_1M	2	/* N = 1 MB, F = 4100, 4 byte pairs */
+
+/* The LZSS code of every chunk went through the Huffman stage of
+huffman_coding/huffman.h too. Only lzsspa writes it. */
+#define CONTAINER_HUFFMAN	0x100
+
+typedef struct {
+	unsigned long long offset;	/* where the chunk's code starts in the file */
+	unsigned int csize;		/* bytes of code */
+	unsigned int usize;		/* bytes the code decodes to */
+	unsigned int crc;		/* checksum() of the decoded bytes */
+	unsigned int flags;		/* CHUNK_* */
+} ChunkEntry;
+
+/* The chunk was coded with a window that starts on the text before it instead
+of spaces (a PrimedDecoder decodes it). Set it in the table after
+containerWriteChunk(). */
+#define CHUNK_PRIMED	1
+
+/* The chunk's code is its text as it is (csize == usize), for input that
+wouldn't shrink. The decoders never see it. */
+#define CHUNK_STORED	2
+
+typedef struct {
+	FILE *fp;
+	unsigned int flags;		/* format flags from the header */
+	unsigned int chunks;		/* entries in table */
+	unsigned long long size;	/* total uncompressed size */
+	unsigned long long next;	/* where the next chunk's code goes */
+	ChunkEntry *table;
+	unsigned long long *start;	/* where each chunk's text starts, and
+					   c->size last (containerOpen() only) */
+} Container;
+
+/* CRC-32 (the zlib/PNG one) of n bytes of buf, continuing from crc. Start with 0. */
+unsigned int checksum(unsigned int crc, const void *buf, size_t n);
+
+/* Start a container of chunks chunks on fp, which must be open for writing.
+A blank header is written; the real one is written by containerFinish(), with
+whatever has been stored in c->flags by then (0 to start with).
+Returns 0 on success, -1 on failure. */
+int containerCreate(Container *c, FILE *fp, unsigned int chunks);
+
+/* Append the code of chunk index (csize bytes) to the container and record it in
+the table. Chunks may be written in any order, each one exactly once.
+Returns 0 on success, -1 on failure. */
+int containerWriteChunk(Container *c, unsigned int index, const void *code,
+		unsigned int csize, unsigned int usize, unsigned int crc);
+
+/* Make room for more chunks in a container opened with containerOpen() on a
+file open for reading and writing. They are numbered from the old c->chunks
+on, and written and finished like those of a new container.
+Returns 0 on success, -1 on failure. */
+int containerAppend(Container *c, unsigned int more);
+
+/* Write the chunk table and the header. The table is freed and fp is left open.
+Returns 0 on success, -1 on failure. */
+int containerFinish(Container *c);
+
+/* Read the header and the chunk table of the container open for reading on fp.
+Returns 0 on success, -1 if fp doesn't hold a container. */
+int containerOpen(Container *c, FILE *fp);
+
+/* The chunk whose text holds byte offset of the whole, found by a binary search
+of c->start, or c->chunks if offset is past the end. */
+unsigned int containerFindChunk(const Container *c, unsigned long long offset);
+
+/* Read the code of chunk index into code, which must hold table[index].csize
+bytes. Safe to call from several threads at once.
+Returns 0 on success, -1 on failure. */
+int containerReadChunk(Container *c, unsigned int index, void *code);
+
+/* Decodes size bytes of code into out, writing no more than limit bytes, and
+returns the number of bytes written. The Decode() of every encoder fits. */
+typedef int (*ChunkDecoder)(const unsigned char *in, int size, unsigned char *out, int limit);
+
+/* The same, for a chunk coded with the dict_size bytes at dict in its window. */
+typedef int (*PrimedDecoder)(const unsigned char *dict, int dict_size,
+		const unsigned char *in, int size, unsigned char *out, int limit);
+
+/* Decode every chunk at once on threads threads (0 for one per core), each one
+straight into its place in out, which must hold c->size bytes. decode must be
+safe to call from several threads at once. Every chunk is checked against its
+size and checksum; *bad (if not NULL) is set to the first damaged one, or to
+c->chunks if there is none. Returns 0 on success, -1 on failure. */
+int containerDecodeAll(Container *c, unsigned char *out, int threads,
+		ChunkDecoder decode, unsigned int *bad);
+
+/* The same, decoding the CHUNK_PRIMED chunks with primed and the text before
+them as their dict, in order once the others are done. containerDecodeAll()
+counts them as damaged. */
+int containerDecodeAllPrimed(Container *c, unsigned char *out, int threads,
+		ChunkDecoder decode, PrimedDecoder primed, unsigned int *bad);
+
+/* Decode the len bytes of the text that start at offset into out, decoding only
+the chunks that hold them (and, for a CHUNK_PRIMED one, up to 1 MB of chunks
+before it). decode, primed (which may be NULL) and *bad are as in
+containerDecodeAllPrimed(). Returns 0 on success, -1 on failure, which includes
+a range that doesn't fit in c->size. */
+int containerDecodeRange(Container *c, unsigned long long offset, size_t len,
+		unsigned char *out, int threads, ChunkDecoder decode, PrimedDecoder primed,
+		unsigned int *bad);
+
+/* Free the chunk table (and starts) of a container opened with containerOpen().
+fp is left open. */
+void containerClose(Container *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
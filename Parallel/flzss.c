@@ -0,0 +1,523 @@
+/* C file that implements libflzss as specified in flzss.h */
+
+#include <stdlib.h>
+#include <string.h>
+#include "flzss.h"
+#include "simd.h"
+#include "pool.h"
+
+#define CHUNK_SIZE	(1024 * 1024)	/* default chunk of a stream encoder */
+#define MAX_CHUNK	FLZSS_MAX_FRAME
+#define STREAM_HEAD	FLZSS_STREAM_HEAD
+#define FRAME_HEAD	FLZSS_FRAME_HEAD
+#define DICT_DMER	4	/* bytes of the strings a dict is trained on */
+#define DICT_SEGMENT	128	/* bytes of sample a trained dict is made of at a time */
+#define DICT_HASH_BITS	20	/* log2 of the number of counters of those strings */
+
+#ifdef FLZSS_STATS
+#define STAT(x)	(x)	/* counted into the encoder's FlzssStats */
+#else
+#define STAT(x)
+#endif
+
+/* One copy of the encoder and decoder per format, see lzssfmt.h */
+#define FMT(name)	name##4K
+#define FMT_WINDOW_BITS	12
+#define FMT_LENGTH_BITS	4
+#include "lzssfmt.h"
+
+#define FMT(name)	name##64K
+#define FMT_WINDOW_BITS	16
+#define FMT_LENGTH_BITS	8
+#include "lzssfmt.h"
+
+#define FMT(name)	name##1M
+#define FMT_WINDOW_BITS	20
+#define FMT_LENGTH_BITS	12
+#include "lzssfmt.h"
+
+typedef struct {
+	const char *name;	/* window size as given on the command line */
+	int window, dict_size;	/* and the most of a dict it holds */
+	size_t tree_size;	/* bytes of the encoder's search state */
+	void (*prime)(void *tree, const unsigned char *dict, int dict_size);
+	int (*encode)(void *tree, int chain_depth, int level, FlzssStats *stats,
+			const unsigned char *dict, int dict_size, const void *snap,
+			const unsigned char *in, int upper, unsigned char *out);
+	ChunkDecoder decode;
+	PrimedDecoder primed;
+} Format;
+
+/* indexed by CONTAINER_FORMAT_* */
+static const Format formats[] = {
+	{ "4k", 1 << 12, DictSize4K, sizeof(Tree4K), Prime4K, Encode4K, Decode4K, DecodePrimed4K },
+	{ "64k", 1 << 16, DictSize64K, sizeof(Tree64K), Prime64K, Encode64K, Decode64K,
+		DecodePrimed64K },
+	{ "1m", 1 << 20, DictSize1M, sizeof(Tree1M), Prime1M, Encode1M, Decode1M, DecodePrimed1M }
+};
+#define FORMATS	(int) (sizeof(formats) / sizeof(formats[0]))
+
+struct FlzssEncoder {
+	const Format *format;
+	int chain_depth, level;
+	void *tree;		/* the format's Tree */
+	FlzssStats stats;
+};
+
+struct FlzssDecoder {
+	const Format *format;	/* the decoders need no state but the output */
+};
+
+struct FlzssDict {
+	const Format *format;
+	unsigned char *data;	/* the end of the dict, as much as the window holds */
+	int size;
+	void *tree;		/* the format's Tree primed with it, which encoders copy */
+};
+
+/* bytes waiting in data[start .. end) */
+typedef struct {
+	unsigned char *data;
+	size_t start, end, room;
+} Buffer;
+
+struct FlzssStream {
+	int encoding;
+	int failed, finished;
+	int chunk_size;
+	FlzssEncoder *encoder;
+	FlzssDecoder *decoder;	/* made once the stream head has come */
+	Buffer in, out;		/* pushed, not yet coded; coded, not yet pulled */
+};
+
+int flzssFormat(const char *name){
+	int i;
+
+	for (i = 0; i < FORMATS; i++)
+		if (strcmp(formats[i].name, name) == 0) return i;
+	return -1;
+}
+
+int flzssWindow(int format){
+	return format < 0 || format >= FORMATS ? 0 : formats[format].window;
+}
+
+ChunkDecoder flzssChunkDecoder(int format){
+	return format < 0 || format >= FORMATS ? NULL : formats[format].decode;
+}
+
+PrimedDecoder flzssPrimedDecoder(int format){
+	return format < 0 || format >= FORMATS ? NULL : formats[format].primed;
+}
+
+FlzssEncoder *flzssEncoderCreate(int format, int chain_depth){
+	FlzssEncoder *e;
+
+	if (format < 0 || format >= FORMATS || chain_depth < 0) return NULL;
+	if ((e = (FlzssEncoder *) calloc(1, sizeof(FlzssEncoder))) == NULL) return NULL;
+	e->format = &formats[format];
+	e->chain_depth = chain_depth;
+	simdName();	/* chosen before any thread encodes */
+	/* the trees of the last encoder of the size, if it was freed; zeroed,
+	   so the padding simdMatch() reads is defined too */
+	if ((e->tree = poolTake(e->format->tree_size)) == NULL) {
+		free(e);
+		return NULL;
+	}
+	memset(e->tree, 0, e->format->tree_size);
+	return e;
+}
+
+void flzssEncoderFree(FlzssEncoder *e){
+	if (e == NULL) return;
+	poolGive(e->tree);
+	free(e);
+}
+
+int flzssEncoderLevel(FlzssEncoder *e, int level){
+	if (level < FLZSS_LEVEL_GREEDY || level > FLZSS_LEVEL_OPTIMAL) return -1;
+	e->level = level;
+	return 0;
+}
+
+int flzssCompressChunk(FlzssEncoder *e, const void *in, int size, void *out){
+	return flzssCompressPrimed(e, NULL, 0, in, size, out);
+}
+
+/* encode with dict, and with snap, its primed tree, if it has one */
+static int compress(FlzssEncoder *e, const void *dict, int dict_size, const void *snap,
+		const void *in, int size, void *out){
+	int n;
+
+	if (size < 0 || dict_size < 0) return -1;
+	n = e->format->encode(e->tree, e->chain_depth, e->level, &e->stats,
+			(const unsigned char *) dict, dict_size, snap,
+			(const unsigned char *) in, size, (unsigned char *) out);
+	STAT(e->stats.bytes_in += size);
+	STAT(e->stats.bytes_out += n);
+	return n;
+}
+
+int flzssCompressPrimed(FlzssEncoder *e, const void *dict, int dict_size,
+		const void *in, int size, void *out){
+	return compress(e, dict, dict_size, NULL, in, size, out);
+}
+
+int flzssCompressDict(FlzssEncoder *e, const FlzssDict *dict, const void *in, int size, void *out){
+	if (dict->format != e->format) return -1;
+	return compress(e, dict->data, dict->size, dict->tree, in, size, out);
+}
+
+int flzssStatsEnabled(void){
+#ifdef FLZSS_STATS
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+void flzssEncoderStats(FlzssEncoder *e, FlzssStats *stats, int reset){
+	if (stats != NULL) *stats = e->stats;
+	if (reset) memset(&e->stats, 0, sizeof(FlzssStats));
+}
+
+void flzssStatsAdd(FlzssStats *sum, const FlzssStats *from){
+	int i;
+
+	sum->bytes_in += from->bytes_in;  sum->bytes_out += from->bytes_out;
+	sum->inserts += from->inserts;  sum->nodes += from->nodes;
+	sum->literals += from->literals;  sum->matches += from->matches;
+	for (i = 0; i < FLZSS_STAT_LENGTHS; i++) sum->lengths[i] += from->lengths[i];
+}
+
+FlzssDecoder *flzssDecoderCreate(int format){
+	FlzssDecoder *d;
+
+	if (format < 0 || format >= FORMATS) return NULL;
+	if ((d = (FlzssDecoder *) malloc(sizeof(FlzssDecoder))) == NULL) return NULL;
+	d->format = &formats[format];
+	return d;
+}
+
+void flzssDecoderFree(FlzssDecoder *d){
+	free(d);
+}
+
+int flzssDecompressChunk(FlzssDecoder *d, const void *in, int size, void *out, int limit){
+	if (size < 0 || limit < 0) return -1;
+	return d->format->decode((const unsigned char *) in, size, (unsigned char *) out, limit);
+}
+
+int flzssDecompressPrimed(FlzssDecoder *d, const void *dict, int dict_size,
+		const void *in, int size, void *out, int limit){
+	if (size < 0 || limit < 0 || dict_size < 0) return -1;
+	return d->format->primed((const unsigned char *) dict, dict_size,
+			(const unsigned char *) in, size, (unsigned char *) out, limit);
+}
+
+int flzssDecompressDict(FlzssDecoder *d, const FlzssDict *dict,
+		const void *in, int size, void *out, int limit){
+	if (dict->format != d->format) return -1;
+	return flzssDecompressPrimed(d, dict->data, dict->size, in, size, out, limit);
+}
+
+
+/* Dicts */
+
+int flzssDictSize(int format){
+	return format < 0 || format >= FORMATS ? 0 : formats[format].dict_size;
+}
+
+FlzssDict *flzssDictCreate(int format, const void *dict, int dict_size){
+	FlzssDict *d;
+
+	if (format < 0 || format >= FORMATS || dict_size < 0) return NULL;
+	if ((d = (FlzssDict *) calloc(1, sizeof(FlzssDict))) == NULL) return NULL;
+	d->format = &formats[format];
+	if (dict_size > d->format->dict_size) {
+		dict = (const unsigned char *) dict + dict_size - d->format->dict_size;
+		dict_size = d->format->dict_size;
+	}
+	d->size = dict_size;
+	simdName();	/* the priming searches too */
+	if ((d->data = (unsigned char *) malloc(dict_size + 1)) == NULL
+	 || (d->tree = poolTake(d->format->tree_size)) == NULL) {
+		flzssDictFree(d);
+		return NULL;
+	}
+	if (dict_size > 0) memcpy(d->data, dict, dict_size);
+	memset(d->tree, 0, d->format->tree_size);
+	d->format->prime(d->tree, d->data, d->size);
+	return d;
+}
+
+void flzssDictFree(FlzssDict *d){
+	if (d == NULL) return;
+	free(d->data);
+	poolGive(d->tree);
+	free(d);
+}
+
+static unsigned int dmerHash(const unsigned char *p){
+	unsigned long long x = 0;
+
+	memcpy(&x, p, DICT_DMER);
+	return (unsigned int) ((x * 0x9e3779b97f4a7c15ull) >> (64 - DICT_HASH_BITS));
+}
+
+/* a piece of sample chosen for the dict, and what it was worth */
+typedef struct {
+	size_t start;
+	int len;
+	unsigned long long score;
+} Segment;
+
+static int byScore(const void *a, const void *b){
+	const Segment *x = (const Segment *) a, *y = (const Segment *) b;
+
+	return x->score < y->score ? -1 : x->score > y->score;
+}
+
+/* Cover (Liao, Petri, Moffat and Wirth, 2016): every DICT_DMER byte string is
+worth the number of samples it is found in. The samples are split into epochs,
+one per DICT_SEGMENT bytes of dict, and from each the segment worth the most is
+taken, each string counted once per segment. Its strings are then worth nothing,
+so no later segment repeats them. The best segments go last, nearest the text,
+where the window keeps them even when the dict is cut. */
+int flzssTrainDict(void *dict, int capacity, const void *samples, const size_t *sizes, int count){
+	const unsigned char *text = (const unsigned char *) samples;
+	unsigned int *worth, *seen, h;
+	unsigned char *active;
+	Segment *segment;
+	size_t total = 0, lo, hi, a, b, p, q, end, top, best_p;
+	unsigned long long score, best;
+	int i, j, epochs, taken = 0, size = 0, best_len;
+
+	if (capacity < 0 || count < 0) return -1;
+	for (i = 0; i < count; i++) total += sizes[i];
+	if (total <= (size_t) capacity) {	/* all of it fits */
+		memcpy(dict, samples, total);
+		return (int) total;
+	}
+	epochs = capacity / DICT_SEGMENT;
+	worth = (unsigned int *) calloc(1 << DICT_HASH_BITS, sizeof(unsigned int));
+	seen = (unsigned int *) calloc(1 << DICT_HASH_BITS, sizeof(unsigned int));
+	active = (unsigned char *) calloc(1 << DICT_HASH_BITS, 1);
+	segment = (Segment *) malloc((epochs + 1) * sizeof(Segment));
+	if (worth == NULL || seen == NULL || active == NULL || segment == NULL) {
+		free(worth);  free(seen);  free(active);  free(segment);
+		return -1;
+	}
+	for (i = 0, a = 0; i < count; a += sizes[i++])	/* samples holding each string */
+		for (p = a; p + DICT_DMER <= a + sizes[i]; p++)
+			if (seen[h = dmerHash(text + p)] != (unsigned int) i + 1) {
+				seen[h] = i + 1;  worth[h]++;
+			}
+	for (j = 0, i = 0, a = 0; j < epochs; j++) {
+		lo = total / epochs * j;  hi = j + 1 < epochs ? total / epochs * (j + 1) : total;
+		best = 0;  best_p = 0;  best_len = 0;
+		for ( ; i < count && a < hi; a += sizes[i++]) {	/* samples in [lo, hi) */
+			b = a + sizes[i];
+			if (b <= lo) continue;
+			p = a > lo ? a : lo;  top = b < hi ? b : hi;
+			for (score = 0, q = p; p < top; p++) {	/* segment [p, end), strings [p, q) counted */
+				end = p + DICT_SEGMENT < b ? p + DICT_SEGMENT : b;
+				for ( ; q + DICT_DMER <= end; q++)
+					if (active[h = dmerHash(text + q)]++ == 0) score += worth[h];
+				if (score > best) {
+					best = score;  best_p = p;  best_len = (int) (end - p);
+				}
+				if (p < q && --active[h = dmerHash(text + p)] == 0) score -= worth[h];
+			}
+			for ( ; p < q; p++) active[dmerHash(text + p)]--;
+			if (b > hi) break;	/* the next epoch starts in this sample */
+		}
+		if (best == 0) continue;
+		for (p = best_p; p + DICT_DMER <= best_p + best_len; p++) worth[dmerHash(text + p)] = 0;
+		segment[taken].start = best_p;  segment[taken].len = best_len;
+		segment[taken++].score = best;
+	}
+	qsort(segment, taken, sizeof(Segment), byScore);
+	for (j = 0; j < taken; j++) {
+		memcpy((unsigned char *) dict + size, text + segment[j].start, segment[j].len);
+		size += segment[j].len;
+	}
+	free(worth);  free(seen);  free(active);  free(segment);
+	return size;
+}
+
+
+/* Streams */
+
+static void put32(unsigned char *p, unsigned int v){
+	p[0] = v;  p[1] = v >> 8;  p[2] = v >> 16;  p[3] = v >> 24;
+}
+
+static unsigned int get32(const unsigned char *p){
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+/* make room for n more bytes at b->data + b->end */
+static int reserve(Buffer *b, size_t n){
+	unsigned char *p;
+	size_t room;
+
+	if (b->end + n <= b->room) return 0;
+	if (b->start > 0) {		/* move what is left to the front */
+		memmove(b->data, b->data + b->start, b->end - b->start);
+		b->end -= b->start;  b->start = 0;
+		if (b->end + n <= b->room) return 0;
+	}
+	for (room = b->room ? b->room : 4096; room < b->end + n; room *= 2);
+	if ((p = (unsigned char *) realloc(b->data, room)) == NULL) return -1;
+	b->data = p;  b->room = room;
+	return 0;
+}
+
+static int append(Buffer *b, const void *buf, size_t n){
+	if (reserve(b, n) != 0) return -1;
+	memcpy(b->data + b->end, buf, n);
+	b->end += n;
+	return 0;
+}
+
+/* encode the first n bytes waiting in s->in as one frame */
+static int sendFrame(FlzssStream *s, size_t n){
+	const unsigned char *text = s->in.data + s->in.start;
+	unsigned char *head;
+	int csize;
+
+	if (reserve(&s->out, FRAME_HEAD + FLZSS_BOUND(n)) != 0) return -1;
+	head = s->out.data + s->out.end;
+	csize = flzssCompressChunk(s->encoder, text, (int) n, head + FRAME_HEAD);
+	put32(head, (unsigned int) n);  put32(head + 4, csize);
+	put32(head + 8, checksum(0, text, n));
+	s->out.end += FRAME_HEAD + csize;
+	s->in.start += n;
+	return 0;
+}
+
+/* decode every whole frame waiting in s->in */
+static int takeFrames(FlzssStream *s){
+	const unsigned char *p;
+	unsigned int usize, csize, crc;
+	int n;
+
+	for ( ; ; ) {
+		p = s->in.data + s->in.start;
+		if (s->decoder == NULL) {	/* the stream head comes first */
+			if (s->in.end - s->in.start < STREAM_HEAD) return 0;
+			if (memcmp(p, "FLZF", 4) != 0 || p[4] != 1
+			 || (s->decoder = flzssDecoderCreate(p[5])) == NULL) return -1;
+			s->in.start += STREAM_HEAD;
+			continue;
+		}
+		if (s->in.end - s->in.start < FRAME_HEAD) return 0;
+		usize = get32(p);  csize = get32(p + 4);  crc = get32(p + 8);
+		if (usize == 0 && csize == 0) {		/* end of stream */
+			if (crc != 0 || s->in.end - s->in.start > FRAME_HEAD) return -1;
+			s->in.start += FRAME_HEAD;
+			s->finished = 1;
+			return 0;
+		}
+		if (usize > MAX_CHUNK || csize > FLZSS_BOUND(usize)) return -1;
+		if (s->in.end - s->in.start < FRAME_HEAD + csize) return 0;
+		if (reserve(&s->out, usize) != 0) return -1;
+		n = flzssDecompressChunk(s->decoder, p + FRAME_HEAD, (int) csize,
+				s->out.data + s->out.end, (int) usize);
+		if (n != (int) usize || checksum(0, s->out.data + s->out.end, n) != crc) return -1;
+		s->out.end += n;
+		s->in.start += FRAME_HEAD + csize;
+	}
+}
+
+static FlzssStream *newStream(int encoding){
+	FlzssStream *s = (FlzssStream *) calloc(1, sizeof(FlzssStream));
+
+	if (s != NULL) s->encoding = encoding;
+	return s;
+}
+
+FlzssStream *flzssStreamEncoder(int format, int chain_depth, int chunk_size){
+	FlzssStream *s;
+	unsigned char head[STREAM_HEAD] = { 'F', 'L', 'Z', 'F', 1, 0, 0, 0 };
+
+	if (chunk_size < 0 || chunk_size > MAX_CHUNK) return NULL;
+	if ((s = newStream(1)) == NULL) return NULL;
+	if ((s->encoder = flzssEncoderCreate(format, chain_depth)) == NULL) {
+		free(s);
+		return NULL;
+	}
+	if (chunk_size == 0)
+		chunk_size = CHUNK_SIZE > 8 * flzssWindow(format) ? CHUNK_SIZE : 8 * flzssWindow(format);
+	s->chunk_size = chunk_size;
+	head[5] = (unsigned char) format;
+	if (append(&s->out, head, STREAM_HEAD) != 0) {
+		flzssStreamFree(s);
+		return NULL;
+	}
+	return s;
+}
+
+int flzssStreamLevel(FlzssStream *s, int level){
+	if (!s->encoding) return -1;
+	return flzssEncoderLevel(s->encoder, level);
+}
+
+FlzssStream *flzssStreamDecoder(void){
+	return newStream(0);
+}
+
+int flzssPush(FlzssStream *s, const void *buf, size_t n){
+	if (s->failed || s->finished) return -1;
+	if (append(&s->in, buf, n) != 0) {
+		s->failed = 1;
+		return -1;
+	}
+	if (s->encoding) {
+		while (s->in.end - s->in.start >= (size_t) s->chunk_size)
+			if (sendFrame(s, s->chunk_size) != 0) {
+				s->failed = 1;
+				return -1;
+			}
+	} else if (takeFrames(s) != 0) {
+		s->failed = 1;
+		return -1;
+	}
+	return 0;
+}
+
+int flzssFinish(FlzssStream *s){
+	unsigned char end[FRAME_HEAD] = { 0 };
+
+	if (s->failed) return -1;
+	if (!s->encoding) return s->finished ? 0 : -1;
+	if (s->finished) return 0;
+	if ((s->in.end > s->in.start && sendFrame(s, s->in.end - s->in.start) != 0)
+	 || append(&s->out, end, FRAME_HEAD) != 0) {
+		s->failed = 1;
+		return -1;
+	}
+	s->finished = 1;
+	return 0;
+}
+
+size_t flzssPull(FlzssStream *s, void *buf, size_t n){
+	if (n > s->out.end - s->out.start) n = s->out.end - s->out.start;
+	memcpy(buf, s->out.data + s->out.start, n);
+	s->out.start += n;
+	if (s->out.start == s->out.end) s->out.start = s->out.end = 0;
+	return n;
+}
+
+size_t flzssPending(const FlzssStream *s){
+	return s->out.end - s->out.start;
+}
+
+void flzssStreamFree(FlzssStream *s){
+	if (s == NULL) return;
+	flzssEncoderFree(s->encoder);
+	flzssDecoderFree(s->decoder);
+	free(s->in.data);  free(s->out.data);
+	free(s);
+}
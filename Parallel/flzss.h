@@ -0,0 +1,188 @@
+/* Header file for libflzss, the LZSS coder of the parallel encoders as a library
+Include this file in your code and link flzss.c, simd.c, container.c and pool.c
+(with -pthread), or libflzss.a as the README builds it, if you want to compress
+or decompress buffers in your own process instead of running lzsspa.
+
+Encoders and decoders are context objects. A context owns the search trees and
+the ring buffer, so nothing is shared between contexts and each thread can use
+its own. The state is reused by every call on the context.
+
+There are two ways to use them:
+
+	flzssCompressChunk(), flzssDecompressChunk()
+		one buffer in, one buffer out. A chunk is what the container
+		keeps in each of its parts.
+	flzssCompressPrimed(), flzssDecompressPrimed()
+		the same, with the window starting on the end of a dict instead
+		of spaces, e.g. the chunk before (a CHUNK_PRIMED chunk).
+	flzssCompressDict(), flzssDecompressDict()
+		the same with a FlzssDict, a dict made ready once and then
+		shared: its encoders start from a copy of the trees it primed,
+		so a short text costs only its own strings. flzssTrainDict()
+		makes the dict from samples of the texts, e.g. small messages.
+	flzssPush(), flzssPull()
+		a stream of any length. The encoder cuts it into chunks and sends
+		each one as a frame: a 12 byte head (decoded size, code size,
+		checksum(), little endian) and then its code. The stream starts
+		with "FLZF", version 1, the format, and 2 zero bytes. It ends with
+		a frame whose three numbers are 0.
+
+Every function that returns an int returns -1 on failure.
+
+Built with -DFLZSS_STATS, each encoder also counts what its search and its
+output look like (FlzssStats). Without it the counting is compiled out and the
+counters stay 0.
+*/
+
+#ifndef FLZSS_H
+#define FLZSS_H
+
+#include <stddef.h>
+#include "container.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Worst case code size of n input bytes (all literals), in any format */
+#define FLZSS_BOUND(n)	((n) + (n) / 8 + 9)
+
+/* Bytes of the head of a stream and of each frame, and the most a frame may
+decode to, for programs that write or read the frames themselves. */
+#define FLZSS_STREAM_HEAD	8
+#define FLZSS_FRAME_HEAD	12
+#define FLZSS_MAX_FRAME		(1 << 30)
+
+/* How an encoder parses its text. Every level writes the same code, which any
+decoder reads: the higher ones only choose their matches better, and slower. */
+#define FLZSS_LEVEL_GREEDY	0	/* the longest match of each string (the default) */
+#define FLZSS_LEVEL_LAZY	1	/* a match waits a byte if the next one is longer */
+#define FLZSS_LEVEL_OPTIMAL	2	/* the fewest bits for each block of 4096 strings */
+
+#define FLZSS_STAT_LENGTHS	64	/* match lengths counted one by one */
+
+typedef struct {
+	unsigned long long bytes_in, bytes_out;	/* of every chunk compressed */
+	unsigned long long inserts;	/* strings looked up and inserted */
+	unsigned long long nodes;	/* tree nodes (or chain candidates) visited by
+					   them, nodes / inserts long on degenerate trees */
+	unsigned long long literals, matches;
+	unsigned long long lengths[FLZSS_STAT_LENGTHS];	/* matches of each length,
+					   the last one of that length or longer */
+} FlzssStats;
+
+typedef struct FlzssEncoder FlzssEncoder;
+typedef struct FlzssDecoder FlzssDecoder;
+typedef struct FlzssStream FlzssStream;
+typedef struct FlzssDict FlzssDict;
+
+/* The CONTAINER_FORMAT_* whose window is called name ("4k", "64k" or "1m"),
+-1 if there is none. */
+int flzssFormat(const char *name);
+
+/* Window of format in bytes, 0 if format is unknown. */
+int flzssWindow(int format);
+
+/* A decoder of format with no context, which allocates its own ring buffer on
+every call. It suits containerDecodeAll(). NULL if format is unknown. */
+ChunkDecoder flzssChunkDecoder(int format);
+
+/* The same, for chunks coded with a dict (CHUNK_PRIMED ones). */
+PrimedDecoder flzssPrimedDecoder(int format);
+
+/* An encoder of format. chain_depth is the number of hash chain candidates
+searched per byte, or 0 to search the binary trees. NULL on failure. */
+FlzssEncoder *flzssEncoderCreate(int format, int chain_depth);
+void flzssEncoderFree(FlzssEncoder *e);
+
+/* Set the FLZSS_LEVEL_* of the chunks e compresses from now on. */
+int flzssEncoderLevel(FlzssEncoder *e, int level);
+
+/* Encode the size bytes at in into out, which must hold FLZSS_BOUND(size)
+bytes. Returns the code size. */
+int flzssCompressChunk(FlzssEncoder *e, const void *in, int size, void *out);
+
+/* The same, but the window starts with the last bytes of the dict_size bytes
+at dict (as many as it holds, fewer if dict_size is smaller), which the text
+may refer back to. The decoder must be given the same dict. */
+int flzssCompressPrimed(FlzssEncoder *e, const void *dict, int dict_size,
+		const void *in, int size, void *out);
+
+/* The same with a dict of the encoder's format; -1 if it is of another one.
+Encodes and decodes the same as flzssCompressPrimed() with the dict's bytes. */
+int flzssCompressDict(FlzssEncoder *e, const FlzssDict *dict, const void *in, int size, void *out);
+
+/* 1 if flzss.c was built with FLZSS_STATS, 0 if its counters stay 0. */
+int flzssStatsEnabled(void);
+
+/* The counters of e since it was created or last reset into stats, and with
+reset set they start again from 0. */
+void flzssEncoderStats(FlzssEncoder *e, FlzssStats *stats, int reset);
+
+/* Adds the counters of from to sum, for example those of every thread. */
+void flzssStatsAdd(FlzssStats *sum, const FlzssStats *from);
+
+/* A decoder of format, NULL on failure. */
+FlzssDecoder *flzssDecoderCreate(int format);
+void flzssDecoderFree(FlzssDecoder *d);
+
+/* Decode the size bytes of code at in into out, writing no more than limit
+bytes. Returns the number of bytes written. */
+int flzssDecompressChunk(FlzssDecoder *d, const void *in, int size, void *out, int limit);
+
+/* Decode code made by flzssCompressPrimed() with the same dict. */
+int flzssDecompressPrimed(FlzssDecoder *d, const void *dict, int dict_size,
+		const void *in, int size, void *out, int limit);
+
+/* Decode code made by flzssCompressDict() with the same dict. */
+int flzssDecompressDict(FlzssDecoder *d, const FlzssDict *dict,
+		const void *in, int size, void *out, int limit);
+
+/* The most bytes of a dict that the window of format holds: the window less
+its longest match. 0 if format is unknown. */
+int flzssDictSize(int format);
+
+/* The last flzssDictSize(format) (or fewer) of the dict_size bytes at dict,
+with the trees and hash chains of format primed on them. It is only read after
+this, so any number of encoders and decoders, on any threads, can share it.
+NULL on failure. */
+FlzssDict *flzssDictCreate(int format, const void *dict, int dict_size);
+void flzssDictFree(FlzssDict *d);
+
+/* Writes a dict of at most capacity bytes (flzssDictSize() of the format it is
+for) into dict, made of the pieces of the count samples that the most of them
+share. The samples lie one after another at samples, sizes[i] bytes each.
+Returns the size of the dict. */
+int flzssTrainDict(void *dict, int capacity, const void *samples, const size_t *sizes, int count);
+
+/* A stream encoder cutting its input into chunk_size byte chunks (0 for the
+default: 1 MB, or 8 windows if that is more). NULL on failure. */
+FlzssStream *flzssStreamEncoder(int format, int chain_depth, int chunk_size);
+
+/* Set the FLZSS_LEVEL_* of a stream encoder, for the chunks not sent yet. */
+int flzssStreamLevel(FlzssStream *s, int level);
+
+/* A stream decoder. The format comes from the stream. NULL on failure. */
+FlzssStream *flzssStreamDecoder(void);
+
+/* Give the stream n more bytes: text to an encoder, code to a decoder. */
+int flzssPush(FlzssStream *s, const void *buf, size_t n);
+
+/* No more input. An encoder sends its last chunk and the end of the stream. A
+decoder checks that the stream has ended. */
+int flzssFinish(FlzssStream *s);
+
+/* Take up to n bytes of output into buf. Returns how many were taken, 0 if
+there are none until more is pushed. */
+size_t flzssPull(FlzssStream *s, void *buf, size_t n);
+
+/* Bytes of output waiting to be pulled. */
+size_t flzssPending(const FlzssStream *s);
+
+void flzssStreamFree(FlzssStream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
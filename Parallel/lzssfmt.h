@@ -0,0 +1,560 @@
+/* Template of the LZSS encoder and decoder of one format
+Include this file once per format, after defining
+
+	FMT(name)		the name of this format's copy of name, e.g. name##4K
+	FMT_WINDOW_BITS		log2 of the ring buffer size N
+	FMT_LENGTH_BITS		bits of the match length in a position-and-length pair
+
+and it defines FMT(Tree), the search state of one encoder, FMT(DictSize),
+FMT(Prime), FMT(Encode), FMT(Decode) and FMT(DecodePrimed). Every format gets its own copy with N, F and
+the code layout as constants, so the extra formats cost the 4 KB one nothing.
+The macros above are #undef'd at the end, ready for the next format.
+STAT(x) must be defined too, as x to keep the counts of the FlzssStats the
+encoder is given or as nothing to compile them out.
+
+A pair takes (FMT_WINDOW_BITS + FMT_LENGTH_BITS) / 8 bytes. With 12 and 4 bits it
+is Okumura's 2 byte code; wider pairs are the position and, above it, the length
+minus (THRESHOLD + 1), stored little endian. THRESHOLD is the size of a pair, so
+no pair is longer than the bytes it replaces.
+*/
+
+#define N		(1 << FMT_WINDOW_BITS)	/* size of ring buffer */
+#define PAIR	((FMT_WINDOW_BITS + FMT_LENGTH_BITS) / 8)	/* bytes of a
+						   position-and-length pair */
+#define THRESHOLD	PAIR	/* encode string into position and length
+						   if match_length is greater than this */
+#define F		((1 << FMT_LENGTH_BITS) + THRESHOLD)	/* upper limit for
+						   match_length */
+#define NIL			N	/* index for root of binary search trees */
+#define HASH_BITS	(FMT_WINDOW_BITS < 16 ? 12 : 16)  /* log2 of the number
+						   of hash chains */
+#if N + 256 < 65536	/* every node and root fits 16 bits: packed nodes */
+#define KEY_BYTES	2	/* of each string kept in its node: 8 byte nodes */
+#define LSON(p)		t->node[p].lson
+#define RSON(p)		t->node[p].rson
+#define DAD(p)		t->node[p].dad
+#else	/* too big for L1 anyway, and three int arrays search faster */
+#define KEY_BYTES	0
+#define LSON(p)		t->lson[p]
+#define RSON(p)		t->rson[p]
+#define DAD(p)		t->dad[p]
+#endif
+#if FMT_WINDOW_BITS > 12	/* a tree of up to N strings, which sorted ones
+			   such as log lines with a rising count make a list */
+#define TREE_CUT	64	/* nodes a search visits at most before the last of
+			   them makes way for the new string */
+#else
+#define TREE_CUT	0	/* none: 4096 nodes are quick, and the code stays as it was */
+#endif
+#define OPT_BLOCK	4096	/* strings parsed at once by the optimal level */
+#define OPT_LENGTHS	64	/* pair lengths it tries below the longest */
+
+#if KEY_BYTES > 0
+typedef struct {
+	unsigned short	lson, rson, dad;  /* left & right children & parent */
+	unsigned char	key[KEY_BYTES];  /* text_buf[p + 1 ..] of node p, all a
+			search compares of it before the strings differ, mostly */
+} FMT(Node);  /* one node is one load, where three arrays and the text were
+		four cache lines a step, and all of them fit in L1 */
+#endif
+
+typedef struct {
+	unsigned char
+		text_buf[N + F - 1 + SIMD_PAD];	/* ring buffer of size N,
+			with extra F-1 bytes to facilitate string comparison,
+			and what simdMatch() may read past them */
+	int		match_position, match_length;  /* of longest match.  These are
+			set by the InsertNode() procedure. */
+#if KEY_BYTES > 0
+	FMT(Node)	node[N + 257];  /* nodes 0 .. N - 1, NIL and the 256 roots
+			-- These constitute binary search trees. */
+#else
+	int		lson[N + 1], rson[N + 257], dad[N + 1];  /* left & right children &
+			parents -- These constitute binary search trees. */
+#endif
+	int		head[1 << HASH_BITS], prev[N];  /* hash chains: head[h] is the
+			latest position whose first 3 bytes hash to h, prev[p]
+			the one before p.  Only used if chain_depth > 0. */
+	int		chain_depth;  /* candidates a hash chain search looks at, 0 to
+			search the trees instead */
+	FlzssStats	*stats;  /* counts of the current Encode() */
+	const unsigned char	*in;  /* the text of the current Encode(), */
+	unsigned long	upper, textcount;  /* its size and the bytes of it read */
+	int		s, r, len;  /* oldest string, string being sent, and the bytes
+			from r on that are text */
+	int		opt_pos[OPT_BLOCK + F], opt_len[OPT_BLOCK + F],
+			opt_choice[OPT_BLOCK + F];
+	unsigned int	opt_cost[OPT_BLOCK + F + 1];  /* bits to send the rest of
+			the block from each string */
+	unsigned char	opt_lit[OPT_BLOCK + F];  /* matches and bytes of the block
+			being parsed by the optimal level, and of the F strings after it */
+} FMT(Tree);
+
+static void FMT(InitTree)(FMT(Tree) *t)  /* initialize trees */
+{
+	int  i;
+
+	/* For i = 0 to N - 1, RSON(i) and LSON(i) will be the right and
+	   left children of node i.  These nodes need not be initialized.
+	   Also, DAD(i) is the parent of node i.  These are initialized to
+	   NIL (= N), which stands for 'not used.'
+	   For i = 0 to 255, RSON(N + i + 1) is the root of the tree
+	   for strings that begin with character i.  These are initialized
+	   to NIL.  Note there are 256 trees. */
+
+	for (i = N + 1; i <= N + 256; i++) RSON(i) = NIL;
+	for (i = 0; i < N; i++) DAD(i) = NIL;
+}
+
+static void FMT(InsertNode)(FMT(Tree) *t, int r)
+	/* Inserts string of length F, text_buf[r..r+F-1], into one of the
+	   trees (text_buf[r]'th tree) and returns the longest-match position
+	   and length via match_position and match_length.
+	   If match_length = F, then removes the old node in favor of the new
+	   one, because the old one will be deleted sooner.
+	   Note r plays double role, as tree node and position in buffer. */
+{
+	int  i, p, cmp, visited = 0;
+	unsigned char  *key;
+
+	cmp = 1;  key = &t->text_buf[r];  p = N + 1 + key[0];
+	RSON(r) = LSON(r) = NIL;  t->match_length = 0;
+#if KEY_BYTES > 0
+	memcpy(t->node[r].key, key + 1, KEY_BYTES);  /* stays as it is while r
+		is in a tree, as all of text_buf[r..r+F-1] does */
+#endif
+	for ( ; ; ) {
+		STAT(t->stats->nodes++);
+		if (cmp >= 0) {
+			if (RSON(p) != NIL) p = RSON(p);
+			else {  RSON(p) = r;  DAD(r) = p;  return;  }
+		} else {
+			if (LSON(p) != NIL) p = LSON(p);
+			else {  LSON(p) = r;  DAD(r) = p;  return;  }
+		}
+#if KEY_BYTES > 0
+		for (i = 1; i <= KEY_BYTES && key[i] == t->node[p].key[i - 1]; i++) ;
+		if (i <= KEY_BYTES) cmp = key[i] - t->node[p].key[i - 1];  /* text_buf
+			not touched */
+		else {
+			i = simdMatch(key, &t->text_buf[p], KEY_BYTES + 1, F);
+			cmp = i < F ? key[i] - t->text_buf[p + i] : 0;
+		}
+#else
+		i = simdMatch(key, &t->text_buf[p], 1, F);
+		cmp = i < F ? key[i] - t->text_buf[p + i] : 0;
+#endif
+		if (i > t->match_length) {
+			t->match_position = p;
+			if ((t->match_length = i) >= F)  break;
+		}
+		if (TREE_CUT > 0 && ++visited >= TREE_CUT) break;  /* r takes the
+			place of p, which is out of order with p's subtrees unless
+			they were equal, so some later searches miss what is
+			there; the matches they find are real, and only the ratio
+			suffers */
+	}
+	DAD(r) = DAD(p);  LSON(r) = LSON(p);  RSON(r) = RSON(p);
+	DAD(LSON(p)) = r;  DAD(RSON(p)) = r;
+	if (RSON(DAD(p)) == p) RSON(DAD(p)) = r;
+	else                   LSON(DAD(p)) = r;
+	DAD(p) = NIL;  /* remove p */
+}
+
+static void FMT(DeleteNode)(FMT(Tree) *t, int p)  /* deletes node p from tree */
+{
+	int  q;
+
+	if (DAD(p) == NIL) return;  /* not in tree */
+	if (RSON(p) == NIL) q = LSON(p);
+	else if (LSON(p) == NIL) q = RSON(p);
+	else {
+		q = LSON(p);
+		if (RSON(q) != NIL) {
+			do {  q = RSON(q);  } while (RSON(q) != NIL);
+			RSON(DAD(q)) = LSON(q);  DAD(LSON(q)) = DAD(q);
+			LSON(q) = LSON(p);  DAD(LSON(p)) = q;
+		}
+		RSON(q) = RSON(p);  DAD(RSON(p)) = q;
+	}
+	DAD(q) = DAD(p);
+	if (RSON(DAD(p)) == p) RSON(DAD(p)) = q;  else LSON(DAD(p)) = q;
+	DAD(p) = NIL;
+}
+
+static void FMT(InitHash)(FMT(Tree) *t)  /* empty all the hash chains */
+{
+	int  i;
+
+	for (i = 0; i < (1 << HASH_BITS); i++) t->head[i] = NIL;
+	for (i = 0; i < N; i++) t->prev[i] = NIL;
+}
+
+static void FMT(InsertHash)(FMT(Tree) *t, int r)
+	/* Same contract as InsertNode(), with hash chains instead of trees:
+	   links text_buf[r..] to the chain of its first 3 bytes and returns
+	   the longest match among the first chain_depth candidates of that
+	   chain.  Nothing is ever unlinked; a candidate is used only while it
+	   is one of the N - F positions behind r that the decoder has too, and
+	   the walk stops at the first link that doesn't lead further back, so
+	   slots reused by newer positions end it. */
+{
+	int  i, p, d, last, depth, len = 0;
+	unsigned char  *key, *text_buf = t->text_buf;
+	unsigned int  h;
+
+	key = &text_buf[r];
+	h = ((key[0] << 16 | key[1] << 8 | key[2]) * 2654435761u) >> (32 - HASH_BITS);
+	p = t->head[h];  t->prev[r] = p;  t->head[h] = r;
+	for (last = 0, depth = t->chain_depth; p != NIL && depth > 0; p = t->prev[p], depth--) {
+		d = (r - p) & (N - 1);  /* how far back p is */
+		if (d <= last || d > N - F) break;
+		last = d;
+		STAT(t->stats->nodes++);
+		if (text_buf[p + len] != key[len]) continue;
+		i = simdMatch(key, &text_buf[p], 0, F);
+		if (i > len) {
+			t->match_position = p;
+			if ((len = i) >= F)  break;
+		}
+	}
+	t->match_length = len;
+}
+
+static void FMT(InsertString)(FMT(Tree) *t, int r)  /* InsertNode() or InsertHash() */
+{
+	STAT(t->stats->inserts++);
+	if (t->chain_depth > 0) FMT(InsertHash)(t, r);  else FMT(InsertNode)(t, r);
+}
+
+static void FMT(DeleteString)(FMT(Tree) *t, int p)  /* hash chains age out, only trees delete */
+{
+	if (t->chain_depth == 0) FMT(DeleteNode)(t, p);
+}
+
+typedef struct {
+	unsigned char	*out;
+	int		size;  /* of the code sent to out so far */
+	unsigned char	buf[1 + 8 * PAIR], mask;  /* buf[1..8 * PAIR] saves
+			eight units of code, and buf[0] works as eight flags, "1"
+			representing that the unit is an unencoded letter (1 byte),
+			"0" a position-and-length pair (PAIR bytes). */
+	int		ptr;  /* next free byte of buf */
+	FlzssStats	*stats;
+} FMT(Code);
+
+static void FMT(Unit)(FMT(Code) *c)  /* one more unit is in buf */
+{
+	int  i;
+
+	if ((c->mask <<= 1) == 0) {  /* Shift mask left one bit. */
+		for (i = 0; i < c->ptr; i++)  /* Send at most 8 units of */
+			c->out[c->size + i] = c->buf[i];  /* code together */
+		c->size += c->ptr;
+		c->buf[0] = 0;  c->ptr = c->mask = 1;
+	}
+}
+
+static void FMT(PutLiteral)(FMT(Code) *c, int ch)
+{
+	STAT(c->stats->literals++);
+	c->buf[0] |= c->mask;  /* 'send one byte' flag */
+	c->buf[c->ptr++] = ch;  /* Send uncoded. */
+	FMT(Unit)(c);
+}
+
+static void FMT(PutPair)(FMT(Code) *c, int position, int length)
+	/* Send position and length pair. Note length > THRESHOLD. */
+{
+	STAT(c->stats->matches++);
+	STAT(c->stats->lengths[length < FLZSS_STAT_LENGTHS ? length : FLZSS_STAT_LENGTHS - 1]++);
+#if PAIR == 2
+	c->buf[c->ptr++] = (unsigned char) position;
+	c->buf[c->ptr++] = (unsigned char)
+		(((position >> 4) & 0xf0) | (length - (THRESHOLD + 1)));
+#else
+	unsigned long  pair = position
+		| (unsigned long) (length - (THRESHOLD + 1)) << FMT_WINDOW_BITS;
+	int  i;
+
+	for (i = 0; i < PAIR; i++)
+		c->buf[c->ptr++] = (unsigned char) (pair >> (8 * i));
+#endif
+	FMT(Unit)(c);
+}
+
+static void FMT(Advance)(FMT(Tree) *t, int n)
+	/* Moves r on by n strings, reading a new byte for each while the text
+	   lasts, and registers every new string, so that match_length and
+	   match_position are those of the string at r. */
+{
+	unsigned char  *text_buf = t->text_buf;
+	int  i, c;
+
+	for (i = 0; i < n && t->textcount < t->upper; i++) {
+		c = t->in[t->textcount++];  /* by count, so 0xff is just a byte */
+		FMT(DeleteString)(t, t->s);		/* Delete old strings and */
+		text_buf[t->s] = c;	/* read new bytes */
+		if (t->s < F - 1) text_buf[t->s + N] = c;  /* If the position is
+			near the end of buffer, extend the buffer to make
+			string comparison easier. */
+		t->s = (t->s + 1) & (N - 1);  t->r = (t->r + 1) & (N - 1);
+			/* Since this is a ring buffer, increment the position
+			   modulo N. */
+		FMT(InsertString)(t, t->r);	/* Register the string in text_buf[r..r+F-1] */
+	}
+	while (i++ < n) {	/* After the end of text, */
+		FMT(DeleteString)(t, t->s);					/* no need to read, but */
+		t->s = (t->s + 1) & (N - 1);  t->r = (t->r + 1) & (N - 1);
+		if (--t->len) FMT(InsertString)(t, t->r);		/* buffer may not be empty. */
+	}
+	if (t->match_length > t->len) t->match_length = t->len;  /* match_length
+		may be spuriously long near the end of text. */
+}
+
+static void FMT(ParseOptimal)(FMT(Tree) *t, FMT(Code) *c)
+	/* Sends the text in blocks of OPT_BLOCK strings.  The match of every
+	   string of a block and of the F strings after it is found first, then,
+	   backwards from the last of those, the cheapest way to send the rest
+	   from each string: a literal (9 bits) or a pair (8 * PAIR + 1 bits) of
+	   any length from THRESHOLD + 1 up to the match's, though past
+	   OPT_LENGTHS only the match's own.  A shorter pair is a prefix of the
+	   match, so it is as valid as the match itself.  Only the units that
+	   start inside the block are sent, so its last match runs on past the
+	   end, as far as it goes; the strings after it start the next block. */
+{
+	int  i, n = 0, l, longest, stop;
+	unsigned int  bits;
+
+	while (n > 0 || t->len > 0) {
+		for ( ; n < OPT_BLOCK + F && t->len > 0; n++) {
+			t->opt_lit[n] = t->text_buf[t->r];
+			t->opt_pos[n] = t->match_position;
+			t->opt_len[n] = t->match_length;
+			FMT(Advance)(t, 1);
+		}
+		stop = t->len > 0 ? OPT_BLOCK : n;  /* the rest, once the text ends */
+		t->opt_cost[n] = 0;
+		for (i = n - 1; i >= 0; i--) {
+			t->opt_cost[i] = t->opt_cost[i + 1] + 9;  t->opt_choice[i] = 1;
+			longest = t->opt_len[i] < n - i ? t->opt_len[i] : n - i;
+			for (l = THRESHOLD + 1; l <= longest; l++) {
+				if (l > OPT_LENGTHS) l = longest;
+				bits = t->opt_cost[i + l] + 8 * PAIR + 1;
+				if (bits <= t->opt_cost[i]) {  /* the longer of two as cheap */
+					t->opt_cost[i] = bits;  t->opt_choice[i] = l;
+				}
+			}
+		}
+		for (i = 0; i < stop; i += t->opt_choice[i])
+			if (t->opt_choice[i] == 1) FMT(PutLiteral)(c, t->opt_lit[i]);
+			else FMT(PutPair)(c, t->opt_pos[i], t->opt_choice[i]);
+		n -= i;  /* not sent yet, to the front */
+		memmove(t->opt_lit, t->opt_lit + i, n);
+		memmove(t->opt_pos, t->opt_pos + i, n * sizeof(int));
+		memmove(t->opt_len, t->opt_len + i, n * sizeof(int));
+	}
+}
+
+enum { FMT(DictSize) = N - F };	/* the most of a dict Encode() keeps */
+
+static void FMT(Fill)(FMT(Tree) *t, const unsigned char *dict, int primed)
+	/* the buffer before r as Encode() starts it: spaces, then the last
+	   primed bytes of dict */
+{
+	int  i;
+
+	for (i = t->s; i < t->r - primed; i++) t->text_buf[i] = ' ';  /* Clear the
+		buffer with any character that will appear often. */
+	if (primed > 0) memcpy(t->text_buf + t->r - primed, dict, primed);
+}
+
+static void FMT(Prime)(void *tree, const unsigned char *dict, int dict_size)
+	/* Makes tree the snapshot Encode() starts from when it is given the
+	   same dict: the buffer filled, and every string of the dict that
+	   ends inside it inserted, in the trees and in the hash chains both.
+	   The last F - 1 strings run on into the text, so each Encode() inserts
+	   those itself.  Copying the snapshot costs a fraction of inserting
+	   N - F strings, which for a short text is most of the work. */
+{
+	FMT(Tree)  *t = (FMT(Tree) *) tree;
+	FlzssStats  stats;
+	int  i, primed = dict_size < N - F ? dict_size : N - F;
+
+	t->stats = &stats;  t->chain_depth = 1;  /* the chains are the same
+		whatever the depth, which only limits the search */
+	FMT(InitTree)(t);  FMT(InitHash)(t);
+	t->s = 0;  t->r = N - F;
+	FMT(Fill)(t, dict + dict_size - primed, primed);
+	if (primed > F)
+		for (i = primed; i >= F; i--) {
+			FMT(InsertNode)(t, t->r - i);  FMT(InsertHash)(t, t->r - i);
+		}
+}
+
+static void FMT(Restore)(FMT(Tree) *t, const FMT(Tree) *snap)
+	/* the part of snap that Prime() set and Encode() reads */
+{
+	memcpy(t->text_buf, snap->text_buf, N - F);
+	if (t->chain_depth > 0) {
+		memcpy(t->head, snap->head, sizeof(t->head));
+		memcpy(t->prev, snap->prev, sizeof(t->prev));
+	} else {
+#if KEY_BYTES > 0
+		memcpy(t->node, snap->node, sizeof(t->node));
+#else
+		memcpy(t->lson, snap->lson, sizeof(t->lson));
+		memcpy(t->rson, snap->rson, sizeof(t->rson));
+		memcpy(t->dad, snap->dad, sizeof(t->dad));
+#endif
+	}
+}
+
+static int FMT(Encode)(void *tree, int chain_depth, int level, FlzssStats *stats,
+		const unsigned char *dict, int dict_size, const void *snap,
+		const unsigned char *in, int upper, unsigned char *out)
+	/* Encodes the upper bytes at in into out, which must hold
+	   CODED_BOUND(upper) bytes, and returns the code size.  tree is the
+	   FMT(Tree) to search with, by hash chains chain_depth deep or by the
+	   binary trees if chain_depth is 0, level the FLZSS_LEVEL_* of the
+	   parse, and stats what STAT() counts into.  The last N - F of the
+	   dict_size bytes at dict (none if dict_size is 0) fill the buffer
+	   instead of spaces, so the text can refer back to them.  snap, if
+	   not NULL, is the tree Prime() made of the same dict. */
+{
+	FMT(Tree)  *t = (FMT(Tree) *) tree;
+	unsigned char  *text_buf = t->text_buf;
+	FMT(Code)  c;
+	int  i, ch, len, position, primed = dict_size < N - F ? dict_size : N - F;
+
+	t->chain_depth = chain_depth;  t->stats = stats;
+	c.out = out;  c.size = 0;  c.stats = stats;
+	c.buf[0] = 0;  c.ptr = c.mask = 1;
+	t->in = in;  t->upper = upper;  t->textcount = 0;
+	t->s = 0;  t->r = N - F;
+	if (snap == NULL || primed <= F) {
+		snap = NULL;
+		if (chain_depth > 0) FMT(InitHash)(t);  else FMT(InitTree)(t);  /* initialize trees */
+		FMT(Fill)(t, dict + dict_size - primed, primed);
+	} else FMT(Restore)(t, (const FMT(Tree) *) snap);
+	for (len = 0; len < F && t->textcount < t->upper; len++)
+		text_buf[t->r + len] = in[t->textcount++];  /* Read F bytes into the last
+			F bytes of the buffer */
+	if ((t->len = len) == 0) return 0;  /* text of size zero */
+	if (primed > F)
+		for (i = snap != NULL ? F - 1 : primed; i >= 1; i--)
+			FMT(InsertString)(t, t->r - i);  /* every string of the dict (or
+			those not in the snapshot), the latest last so ties go to it */
+	else for (i = 1; i <= F; i++) FMT(InsertString)(t, t->r - i);  /* Insert the F strings,
+		each of which begins with one or more 'space' characters.  Note
+		the order in which these strings are inserted.  This way,
+		degenerate trees will be less likely to occur. */
+	FMT(InsertString)(t, t->r);  /* Finally, insert the whole string just read.
+		match_length and match_position are set. */
+	if (t->match_length > t->len) t->match_length = t->len;
+
+	if (level >= FLZSS_LEVEL_OPTIMAL) FMT(ParseOptimal)(t, &c);
+	else while (t->len > 0) {	/* until length of string to be processed is zero */
+		if (t->match_length <= THRESHOLD) {  /* Not long enough match. */
+			FMT(PutLiteral)(&c, text_buf[t->r]);  /* Send one byte. */
+			FMT(Advance)(t, 1);
+		} else if (level == FLZSS_LEVEL_LAZY && t->match_length < F) {
+			/* one step lazy: if the next string matches further, this
+			   byte goes as a literal and that match gets the same test */
+			position = t->match_position;  len = t->match_length;
+			ch = text_buf[t->r];
+			FMT(Advance)(t, 1);
+			if (t->match_length > len) FMT(PutLiteral)(&c, ch);
+			else {
+				FMT(PutPair)(&c, position, len);
+				FMT(Advance)(t, len - 1);
+			}
+		} else {
+			len = t->match_length;
+			FMT(PutPair)(&c, t->match_position, len);
+			FMT(Advance)(t, len);
+		}
+	}
+	if (c.ptr > 1) {		/* Send remaining code. */
+		for (i = 0; i < c.ptr; i++) out[c.size + i] = c.buf[i];
+		c.size += c.ptr;
+	}
+	return c.size;
+}
+
+static int FMT(DecodePrimed)(const unsigned char *dict, int dict_size,
+		const unsigned char *in, int size, unsigned char *out, int limit)
+	/* Just the reverse of Encode().  Decodes the size bytes of code at in
+	   into out, never writing more than limit bytes, and returns the
+	   number of bytes written.  out itself is the ring buffer: a pair
+	   copies from the bytes already decoded there, 16 at a time when it
+	   reaches back that far and there is room, and from the dict (or the
+	   spaces) Encode() starts its buffer with if it reaches back before
+	   out.  dict may end right where out starts. */
+{
+	int  i, j, k, d, pos = 0, n = 0;
+	unsigned int  flags;
+
+	if (dict_size > N - F) {  /* all that Encode() keeps of it */
+		dict += dict_size - (N - F);  dict_size = N - F;
+	}
+	flags = 0;
+	for ( ; ; ) {
+		if (((flags >>= 1) & 256) == 0) {
+			if (pos >= size) break;
+			flags = in[pos++] | 0xff00;		/* uses higher byte cleverly */
+		}							/* to count eight */
+		if (flags & 1) {
+			if (pos >= size || n >= limit) break;
+			out[n++] = in[pos++];
+		} else {
+			if (pos + PAIR > size) break;
+#if PAIR == 2
+			i = in[pos++];  j = in[pos++];
+			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
+#else
+			unsigned long  pair = 0;
+			for (k = 0; k < PAIR; k++) pair |= (unsigned long) in[pos++] << (8 * k);
+			i = pair & (N - 1);  j = (int) (pair >> FMT_WINDOW_BITS) + THRESHOLD;
+#endif
+			if (n + j >= limit) break;
+			j++;  /* the length */
+			d = (N - F + n - i) & (N - 1);  /* how far back, the ring */
+			if (d == 0) d = N;		/* position being N - F + n */
+			if (d >= 16 && d <= n && n + j + 16 <= limit) {
+				for (k = 0; k < j; k += 16) memcpy(out + n + k, out + n - d + k, 16);
+			} else if (d == 1 && n > 0) {
+				memset(out + n, out[n - 1], j);
+			} else {
+				for (k = 0; k < j; k++)
+					out[n + k] = d - k <= n ? out[n - d + k]
+						: d - k - n <= dict_size ? dict[dict_size - (d - k - n)] : ' ';
+			}
+			n += j;
+		}
+	}
+	return n;
+}
+
+static int FMT(Decode)(const unsigned char *in, int size, unsigned char *out, int limit)
+	/* DecodePrimed() of code that Encode() was given no dict for */
+{
+	return FMT(DecodePrimed)(NULL, 0, in, size, out, limit);
+}
+
+#undef N
+#undef PAIR
+#undef THRESHOLD
+#undef F
+#undef NIL
+#undef HASH_BITS
+#undef KEY_BYTES
+#undef LSON
+#undef RSON
+#undef DAD
+#undef TREE_CUT
+#undef OPT_BLOCK
+#undef OPT_LENGTHS
+#undef FMT
+#undef FMT_WINDOW_BITS
+#undef FMT_LENGTH_BITS
@@ -13,11 +13,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h> 
 #include <time.h>
+#include <sys/mman.h>
+#include "container.h"
+#include "mapfile.h"
 
 #define N		 4096	/* size of ring buffer */
 #define F		   18	/* upper limit for match_length */
@@ -106,7 +110,7 @@ void DeleteNode(int p)  /* deletes node p from tree */
 	dad[p] = NIL;
 }
 
-void Encode(FILE * in, FILE * out, int upper)
+int Encode(const unsigned char * in, unsigned char * out, unsigned long upper)
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
 	unsigned char  code_buf[17], mask;
@@ -115,8 +119,7 @@ void Encode(FILE * in, FILE * out, int upper)
 	unsigned long int
 			textsize = 0,	/* text size counter */
 			textcount = 0,	/* second text size counter */
-			codesize = 0,	/* code size counter */
-			printcount = 0;	/* counter for reporting progress every 1K bytes */
+			codesize = 0;	/* code size counter */
 	
 	InitTree();  /* initialize trees */
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
@@ -127,10 +130,10 @@ void Encode(FILE * in, FILE * out, int upper)
 	s = 0;  r = N - F;
 	for (i = s; i < r; i++) text_buf[i] = ' ';  /* Clear the buffer with
 		any character that will appear often. */
-	for (len = 0; len < F && (c = getc(in)) != EOF && ++textcount <= upper; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
-			the buffer */
-	if ((textsize = len) == 0) return;  /* text of size zero */
+	for (len = 0; len < F && textcount < upper; len++)
+		text_buf[r + len] = in[textcount++];  /* Read F bytes into the last
+			F bytes of the buffer */
+	if ((textsize = len) == 0) return 0;  /* text of size zero */
 	for (i = 1; i <= F; i++) InsertNode(r - i);  /* Insert the F strings,
 		each of which begins with one or more 'space' characters.  Note
 		the order in which these strings are inserted.  This way,
@@ -153,13 +156,13 @@ void Encode(FILE * in, FILE * out, int upper)
 		}
 		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
 			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				putc(code_buf[i], out);     /* code together */
+				out[codesize+i] = code_buf[i];     /* code together */
 			codesize += code_buf_ptr;
 			code_buf[0] = 0;  code_buf_ptr = mask = 1;
 		}
 		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = getc(in)) != EOF && ++textcount <= upper; i++) {
+		for (i = 0; i < last_match_length && textcount < upper; i++) {
+			c = in[textcount++];
 			DeleteNode(s);		/* Delete old strings and */
 			text_buf[s] = c;	/* read new bytes */
 			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
@@ -170,11 +173,7 @@ void Encode(FILE * in, FILE * out, int upper)
 				   modulo N. */
 			InsertNode(r);	/* Register the string in text_buf[r..r+F-1] */
 		}
-		if ((textsize += i) > printcount) {
-			printf("%12ld\r", textsize);  printcount += 1024;
-				/* Reports progress each time the textsize exceeds
-				   multiples of 1024. */
-		}
+		textsize += i;
 		while (i++ < last_match_length) {	/* After the end of text, */
 			DeleteNode(s);					/* no need to read, but */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
@@ -182,45 +181,55 @@ void Encode(FILE * in, FILE * out, int upper)
 		}
 	} while (len > 0);	/* until length of string to be processed is zero */
 	if (code_buf_ptr > 1) {		/* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++) putc(code_buf[i], out);
+		for (i = 0; i < code_buf_ptr; i++) out[codesize+i] = code_buf[i];
 		codesize += code_buf_ptr;
 	}
 	printf("In : %ld bytes\n", textsize);	/* Encoding is done. */
 	printf("Out: %ld bytes\n", codesize);
 	printf("Out/In: %.3f\n", (double)codesize / textsize);
-	fclose(in);
-	fclose(out);
+	return codesize;
 }
 
-void Decode(FILE * in)	/* Just the reverse of Encode(). */
+int Decode(const unsigned char *in, int size, unsigned char *out, int limit)
+	/* Just the reverse of Encode().  Decodes the size bytes of code at in
+	   into out, never writing more than limit bytes, and returns the
+	   number of bytes written. */
 {
-	int  i, j, k, r, c;
+	int  i, j, k, r, c, pos = 0, n = 0;
 	unsigned int  flags;
+	unsigned char  text_buf[N + F - 1];	/* own ring buffer, so that
+			several parts can be decoded at once */
 	
 	for (i = 0; i < N - F; i++) text_buf[i] = ' ';
 	r = N - F;  flags = 0;
 	for ( ; ; ) {
 		if (((flags >>= 1) & 256) == 0) {
-			if ((c = getc(in)) == EOF) break;
-			flags = c | 0xff00;		/* uses higher byte cleverly */
+			if (pos >= size) break;
+			flags = in[pos++] | 0xff00;		/* uses higher byte cleverly */
 		}							/* to count eight */
 		if (flags & 1) {
-			if ((c = getc(in)) == EOF) break;
-			putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+			if (pos >= size || n >= limit) break;
+			c = in[pos++];
+			out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 		} else {
-			if ((i = getc(in)) == EOF) break;
-			if ((j = getc(in)) == EOF) break;
+			if (pos + 1 >= size) break;
+			i = in[pos++];  j = in[pos++];
 			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
+			if (n + j >= limit) break;
 			for (k = 0; k <= j; k++) {
 				c = text_buf[(i + k) & (N - 1)];
-				putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+				out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 			}
 		}
 	}
+	return n;
 }
 
-struct stat st;
 #define PARTITIONS 8
+#define CODED_BOUND(n)	((n) + (n) / 8 + 9)	/* worst case code size of
+						   n input bytes (all literals) */
+#define PART_MAX	((INT_MAX - 9) / 9 * 8)	/* the longest part whose code
+						   an int (and a chunk entry) holds */
 
 //static char path[]="/u/prof";
 
@@ -235,18 +244,35 @@ int main(int argc, char *argv[])
 	}
 	if ((s = argv[1], s[1] || strpbrk(s, "DEde") == NULL)
 	 || (s = argv[2], in = argv[2], (infile  = fopen(s, "rb")) == NULL)
-	 || (s = argv[3], (outfile = fopen(s, "wb")) == NULL)) {
+	 || (s = argv[3], (outfile = fopen(s, "w+b")) == NULL)) {
 		printf("??? %s\n", s);  return EXIT_FAILURE;
 	}
 	if (toupper(*argv[1]) == 'E'){
 		time_t start = time(NULL);
 		printf("\nStart time: %ld\n", start);
 		pid_t pids[PARTITIONS];
-		stat(argv[2], &st);
-		int size = st.st_size;
-		printf("%d\n",size);
-		int part = 0, seeksize = size/PARTITIONS;
-		remove(s);
+		MappedFile input;  /* mapped once, the children share it */
+		if (mapInput(&input, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+		size_t size = input.size;
+		printf("%llu\n", (unsigned long long) size);
+		if (size / PARTITIONS + size % PARTITIONS > PART_MAX) {
+			printf("??? %s is too large for %d parts\n", in, PARTITIONS);
+			return EXIT_FAILURE;
+		}
+		int part = 0, seeksize = (int) (size / PARTITIONS);
+		/* the children encode into shared memory and leave the parent their
+		   code size and checksum, the parent writes the container */
+		char * str_out[PARTITIONS];
+		for(part = 0; part < PARTITIONS; part++){
+			str_out[part] = (char *) mmap (NULL, CODED_BOUND(seeksize + (int) (size % PARTITIONS)),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		}
+		int * sizes = (int *) mmap (NULL, sizeof(int) * PARTITIONS,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		unsigned int * crcs = (unsigned int *) mmap (NULL, sizeof(unsigned int) * PARTITIONS,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 		for(part = 0; part < PARTITIONS; part++){
 			int pid =fork();
 			if(pid > 0) {
@@ -254,39 +280,63 @@ int main(int argc, char *argv[])
 				continue;
 			} else {
 				//chdir(path);
-				FILE * infile_part = fopen(in, "rb");
-				fseek(infile_part, seeksize*part, SEEK_SET);
+				int len = seeksize+(part==PARTITIONS-1 ? (int) (size%PARTITIONS):0);
+				crcs[part] = checksum(0, input.data + (size_t) seeksize*part, len);
 				printf("%.2f%%\n",part/(float)PARTITIONS);
 				printf("\n\nPart: %d\n\n", part);
-				sprintf(s,"%s.%d",s,part);
-				FILE * out = fopen(s, "wb");
-				s[strlen(s)-2] = '\0';
 				nice(-15);
-				Encode(infile_part, out, seeksize+(part==PARTITIONS ? size%PARTITIONS:0));
+				sizes[part] = Encode(input.data + (size_t) seeksize*part, (unsigned char *) str_out[part], len);
 				return EXIT_SUCCESS;
 			}
 		}
+		Container c;
+		if (containerCreate(&c, outfile, PARTITIONS) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
 		for(part = 0; part < PARTITIONS; part++) {
-			if(pids[part] > 0) {
-				printf("\n\nWaiting on part: %d\n\n", part);
-				waitpid(pids[part], NULL, 0);
+			/* write each part as soon as its child is done */
+			pid_t pid = wait(NULL);
+			int done;
+			for(done = 0; done < PARTITIONS && pids[done] != pid; done++);
+			if(done == PARTITIONS) continue;
+			printf("\n\nPart %d done\n\n", done);
+			if (containerWriteChunk(&c, done, str_out[done], sizes[done],
+					seeksize+(done==PARTITIONS-1 ? (int) (size%PARTITIONS):0), crcs[done]) != 0) {
+				printf("??? %s\n", s);  return EXIT_FAILURE;
 			}
 		}
+		if (containerFinish(&c) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		unmapFile(&input);
 		time_t end = time(NULL);// - start;
 		printf("\nEnd time: %ld\n", end);
 		printf("\nTime taken: %f\n",difftime(end, start));
 		//int msec = diff * 1000 / CLOCKS_PER_SEC;
 		//printf("Time taken %d seconds %d milliseconds\n", msec/1000, msec%1000);
 	} else {
-		int part = 0;
-		for(part = 0; part < PARTITIONS; part++){
-			in[strlen(in)-2] = '\0';
-			sprintf(in,"%s.%d",in,part);
-			printf("%s\n",in);
-			FILE * inf = fopen(in, "rb");
-			Decode(inf);
-			fclose(inf);
+		/* every part is decoded at once, straight into its place in text */
+		Container c;
+		unsigned int bad = 0;
+		if (containerOpen(&c, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+		if (c.flags != CONTAINER_FORMAT_4K) {
+			printf("??? %s: only lzsspa decodes this format\n", in);  return EXIT_FAILURE;
+		}
+		MappedFile text;  /* the parts are decoded straight into the output file */
+		if (mapOutput(&text, outfile, c.size) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		if (containerDecodeAll(&c, text.data, 0, Decode, &bad) != 0) {
+			if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+			else printf("??? %s\n", in);
+			return EXIT_FAILURE;
+		}
+		if (unmapFile(&text) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
 		}
+		containerClose(&c);
 	}
 	fclose(infile);  fclose(outfile);
 	return EXIT_SUCCESS;
@@ -18,303 +18,707 @@
 #include <sys/wait.h>
 #include <unistd.h> 
 #include <time.h>
+#include <pthread.h>
+#include "container.h"
+#include "flzss.h"
+#include "../huffman_coding/huffman.h"
+#include "mapfile.h"
+#include "pool.h"
+
+#define CHAIN_DEPTH	16		/* default chain_depth of the h mode */
+#define CHUNK_SIZE	(1024 * 1024)	/* bytes of input encoded by one task,
+						   at least 8 windows though */
+#define STREAM_BATCH	2		/* chunks per worker of a batch in c and x */
+#define SCAN_BLOCK	(64 * 1024)	/* bytes whose entropy decides if they are
+						   coded or stored, a whole number of them
+						   in every chunk */
 
-#define N		 4096	/* size of ring buffer */
-#define F		   18	/* upper limit for match_length */
-#define THRESHOLD	2   /* encode string into position and length
-						   if match_length is greater than this */
-#define NIL			N	/* index for root of binary search trees */
-
-unsigned char
-		text_buf[N + F - 1];	/* ring buffer of size N,
-			with extra F-1 bytes to facilitate string comparison */
-int		match_position, match_length,  /* of longest match.  These are
-			set by the InsertNode() procedure. */
-		lson[N + 1], rson[N + 257], dad[N + 1];  /* left & right children &
-			parents -- These constitute binary search trees. */
 FILE	*infile, *outfile;  /* input & output files */
 
-struct stat st;
+/* what --stats reports of one chunk */
+typedef struct {
+	double read, encode, write;	/* seconds to checksum the mapped input (which
+					   faults it in), to code it and to write it,
+					   waiting for the container included */
+	int codesize, stored;
+	FlzssStats lz;		/* of the LZSS encoder, 0 without FLZSS_STATS */
+} ChunkStats;
 
-#define PARTITIONS 8
+/* the chunks of one encode, shared by the workers of the pool */
+typedef struct {
+	Container *c;
+	const unsigned char *in;	/* the mapped input file */
+	size_t size;		/* of in, which may be more than an int holds */
+	int chunk_size;		/* no chunk is longer than chunk_size */
+	size_t *start;		/* where each chunk starts in in, and size last */
+	unsigned char *raw;	/* each chunk is stored as it is, not coded */
+	size_t base;		/* bytes already in the container before the
+				   chunks coded now */
+	int first;		/* and the chunks it holds */
+	int prime;		/* the first chunk starts its window on the text
+				   before it (a) */
+	FlzssEncoder **encoder;	/* of each worker */
+	unsigned char **out;	/* code buffer of each worker */
+	unsigned char **lz;	/* LZSS code of each worker before the Huffman
+				   stage, NULL without it */
+	ChunkStats *stats;	/* of each chunk, NULL without --stats */
+	long codesize;		/* of all the chunks so far */
+	int failed;
+	pthread_mutex_t lock;	/* one worker writes to the container at a time */
+} EncodeJob;
 
-char * str_in, * str_out[PARTITIONS];
+double seconds(void)	/* monotonic clock, for --stats */
+{
+	struct timespec ts;
 
-void createStringOfSize(int size){
-	str_in = (char *) malloc (size);
-	int i;
-	for(i=0; i<PARTITIONS; i++){
-		str_out[i] = (char *) malloc (size/PARTITIONS + size%PARTITIONS);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void encodeTask(void *arg, int part, int worker)
+{
+	EncodeJob *job = (EncodeJob *) arg;
+	ChunkStats *st = job->stats != NULL ? &job->stats[part] : NULL;
+	double t = st != NULL ? seconds() : 0;
+	size_t offset = job->start[part];
+	int len = (int) (job->start[part + 1] - offset), codesize = len, stored = job->raw[part];
+	int window = flzssWindow(CONTAINER_FORMAT(job->c->flags));
+	/* of the text before the chunk only the last window can be referred to */
+	int dict = part == 0 && job->prime && !stored ? (offset < (size_t) window
+			? (int) offset : window) : 0;
+	unsigned int crc = checksum(0, job->in + offset, len);
+	unsigned char *lz = job->lz != NULL ? job->lz[worker] : job->out[worker];
+	const unsigned char *code = job->in + offset;
+
+	if (st != NULL) {
+		st->read = seconds() - t;  t += st->read;
+	}
+
+	if (!stored) {
+		codesize = flzssCompressPrimed(job->encoder[worker], job->in + offset - dict, dict,
+				job->in + offset, len, lz);
+		if (job->lz != NULL) codesize = huffEncode(lz, codesize, job->out[worker]);
+		if (codesize >= len) {	/* coding didn't pay off after all */
+			codesize = len;  stored = 1;  dict = 0;
+		} else code = job->out[worker];
+	}
+	if (st != NULL) {
+		st->encode = seconds() - t;  t += st->encode;
+		flzssEncoderStats(job->encoder[worker], &st->lz, 1);
+	}
+
+	pthread_mutex_lock(&job->lock);		/* written as soon as it is done */
+	if (containerWriteChunk(job->c, job->first + part, code, codesize, len, crc) != 0)
+		job->failed = 1;
+	else job->c->table[job->first + part].flags |= (dict > 0 ? CHUNK_PRIMED : 0)
+			| (stored ? CHUNK_STORED : 0);
+	job->codesize += codesize;
+	pthread_mutex_unlock(&job->lock);
+	if (st != NULL) {
+		st->write = seconds() - t;  st->codesize = codesize;  st->stored = stored;
 	}
 }
 
-void InitTree(void)  /* initialize trees */
+/* the entropy pre-check, one block of the input per task */
+typedef struct {
+	const unsigned char *in;
+	size_t from, size;	/* of the bytes to check */
+	unsigned char *raw;	/* of each block */
+} ScanJob;
+
+void scanTask(void *arg, int block, int worker)
+	/* Huffman codes of the block's bytes that come to 63/64 of them or more
+	   say it is already compressed: the trees would find next to nothing, and
+	   the flags would make it 1/8 longer */
 {
-	int  i;
-
-	/* For i = 0 to N - 1, rson[i] and lson[i] will be the right and
-	   left children of node i.  These nodes need not be initialized.
-	   Also, dad[i] is the parent of node i.  These are initialized to
-	   NIL (= N), which stands for 'not used.'
-	   For i = 0 to 255, rson[N + i + 1] is the root of the tree
-	   for strings that begin with character i.  These are initialized
-	   to NIL.  Note there are 256 trees. */
-
-	for (i = N + 1; i <= N + 256; i++) rson[i] = NIL;
-	for (i = 0; i < N; i++) dad[i] = NIL;
+	ScanJob *job = (ScanJob *) arg;
+	size_t offset = job->from + (size_t) SCAN_BLOCK * block;
+	int i, n = job->size - offset < SCAN_BLOCK ? (int) (job->size - offset) : SCAN_BLOCK;
+	unsigned long long freq[256], bits = 0;
+	unsigned char len[256];
+
+	(void) worker;
+	huffCount(job->in + offset, n, freq);
+	huffLengths(freq, len);
+	for (i = 0; i < 256; i++) bits += freq[i] * len[i];
+	job->raw[block] = bits * 64 >= (unsigned long long) n * 8 * 63;
 }
 
-void InsertNode(int r)
-	/* Inserts string of length F, text_buf[r..r+F-1], into one of the
-	   trees (text_buf[r]'th tree) and returns the longest-match position
-	   and length via the global variables match_position and match_length.
-	   If match_length = F, then removes the old node in favor of the new
-	   one, because the old one will be deleted sooner.
-	   Note r plays double role, as tree node and position in buffer. */
+int planChunks(EncodeJob *job)
+	/* Cuts in[base .. size) into chunks: a new one wherever the blocks turn
+	   from worth coding to not or back, and after chunk_size bytes. Returns
+	   the number of chunks, -1 if out of memory. */
 {
-	int  i, p, cmp;
-	unsigned char  *key;
-
-	cmp = 1;  key = &text_buf[r];  p = N + 1 + key[0];
-	rson[r] = lson[r] = NIL;  match_length = 0;
-	for ( ; ; ) {
-		if (cmp >= 0) {
-			if (rson[p] != NIL) p = rson[p];
-			else {  rson[p] = r;  dad[r] = p;  return;  }
-		} else {
-			if (lson[p] != NIL) p = lson[p];
-			else {  lson[p] = r;  dad[r] = p;  return;  }
-		}
-		for (i = 1; i < F; i++)
-			if ((cmp = key[i] - text_buf[p + i]) != 0)  break;
-		if (i > match_length) {
-			match_position = p;
-			if ((match_length = i) >= F)  break;
+	ScanJob scan;
+	int block, blocks = (int) ((job->size - job->base + SCAN_BLOCK - 1) / SCAN_BLOCK), chunks = 0;
+
+	job->start = (size_t *) malloc(sizeof(size_t) * (blocks + 1));
+	job->raw = (unsigned char *) malloc(blocks + 1);
+	if (job->start == NULL || job->raw == NULL) return -1;
+	scan.in = job->in;  scan.from = job->base;  scan.size = job->size;  scan.raw = job->raw;
+	if (poolRun(0, blocks, scanTask, &scan) != 0) return -1;
+	for (block = 0; block < blocks; block++) {
+		size_t offset = job->base + (size_t) SCAN_BLOCK * block;
+		/* raw[] becomes that of the chunks, never ahead of the blocks read */
+		if (chunks == 0 || job->raw[block] != job->raw[chunks - 1]
+		 || offset - job->start[chunks - 1] >= (size_t) job->chunk_size) {
+			job->start[chunks] = offset;  job->raw[chunks++] = job->raw[block];
 		}
 	}
-	dad[r] = dad[p];  lson[r] = lson[p];  rson[r] = rson[p];
-	dad[lson[p]] = r;  dad[rson[p]] = r;
-	if (rson[dad[p]] == p) rson[dad[p]] = r;
-	else                   lson[dad[p]] = r;
-	dad[p] = NIL;  /* remove p */
+	job->start[chunks] = job->size;
+	return chunks;
 }
 
-void DeleteNode(int p)  /* deletes node p from tree */
+void printStats(const ChunkStats *stats, int chunks, double map)
+	/* --stats: each chunk's times and counts, then the totals */
 {
-	int  q;
-	
-	if (dad[p] == NIL) return;  /* not in tree */
-	if (rson[p] == NIL) q = lson[p];
-	else if (lson[p] == NIL) q = rson[p];
-	else {
-		q = lson[p];
-		if (rson[q] != NIL) {
-			do {  q = rson[q];  } while (rson[q] != NIL);
-			rson[dad[q]] = lson[q];  dad[lson[q]] = dad[q];
-			lson[q] = lson[p];  dad[lson[p]] = q;
-		}
-		rson[q] = rson[p];  dad[rson[p]] = q;
+	FlzssStats sum;
+	double read = 0, encode = 0, write = 0;
+	int i;
+
+	memset(&sum, 0, sizeof(sum));
+	printf("map: %.3f ms\n", map * 1e3);
+	for (i = 0; i < chunks; i++) {
+		const ChunkStats *st = &stats[i];
+		printf("chunk %d: read %.3f ms, encode %.3f ms, write %.3f ms, %d bytes%s",
+			   i, st->read * 1e3, st->encode * 1e3, st->write * 1e3, st->codesize,
+			   st->stored ? " stored" : "");
+		if (flzssStatsEnabled())
+			printf(", %.2f nodes per insert, %llu literals, %llu matches",
+				   st->lz.inserts ? (double) st->lz.nodes / st->lz.inserts : 0.0,
+				   st->lz.literals, st->lz.matches);
+		printf("\n");
+		read += st->read;  encode += st->encode;  write += st->write;
+		flzssStatsAdd(&sum, &st->lz);
 	}
-	dad[q] = dad[p];
-	if (rson[dad[p]] == p) rson[dad[p]] = q;  else lson[dad[p]] = q;
-	dad[p] = NIL;
+	printf("total: read %.3f ms, encode %.3f ms, write %.3f ms (summed over threads)\n",
+		   read * 1e3, encode * 1e3, write * 1e3);
+	if (!flzssStatsEnabled()) {
+		printf("(built without -DFLZSS_STATS, so no search counts)\n");
+		return;
+	}
+	printf("inserts %llu, nodes %llu (%.2f per insert), literals %llu, matches %llu\n",
+		   sum.inserts, sum.nodes, sum.inserts ? (double) sum.nodes / sum.inserts : 0.0,
+		   sum.literals, sum.matches);
+	for (i = 0; i < FLZSS_STAT_LENGTHS; i++)
+		if (sum.lengths[i] > 0)
+			printf("length %d%s: %llu\n", i, i == FLZSS_STAT_LENGTHS - 1 ? "+" : "",
+				   sum.lengths[i]);
 }
 
-int Encode(int upper, int part, int offset)
+static PrimedDecoder lz_decode;	/* of the container's format */
+
+int decodeHuffmanPrimed(const unsigned char *dict, int dict_size,
+		const unsigned char *in, int size, unsigned char *out, int limit)
+	/* Decoder of a chunk that went through the Huffman stage: first back to
+	   its LZSS code, then to text. */
 {
-	int  i, c, len, r, s, last_match_length, code_buf_ptr;
-	unsigned char  code_buf[17], mask;
-	
-	
-	unsigned long int
-			textsize = 0,	/* text size counter */
-			textcount = 0,	/* second text size counter */
-			codesize = 0,	/* code size counter */
-			printcount = 0;	/* counter for reporting progress every 1K bytes */
-	
-	InitTree();  /* initialize trees */
-	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
-		code_buf[0] works as eight flags, "1" representing that the unit
-		is an unencoded letter (1 byte), "0" a position-and-length pair
-		(2 bytes).  Thus, eight units require at most 16 bytes of code. */
-	code_buf_ptr = mask = 1;
-	s = 0;  r = N - F;
-	for (i = s; i < r; i++) text_buf[i] = ' ';  /* Clear the buffer with
-		any character that will appear often. */
-	for (len = 0; len < F && (c = str_in[textcount+offset]) != EOF && ++textcount <= upper; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
-			the buffer */
-	if ((textsize = len) == 0) return 0;  /* text of size zero */
-	for (i = 1; i <= F; i++) InsertNode(r - i);  /* Insert the F strings,
-		each of which begins with one or more 'space' characters.  Note
-		the order in which these strings are inserted.  This way,
-		degenerate trees will be less likely to occur. */
-	InsertNode(r);  /* Finally, insert the whole string just read.  The
-		global variables match_length and match_position are set. */
-	do {
-		if (match_length > len) match_length = len;  /* match_length
-			may be spuriously long near the end of text. */
-		if (match_length <= THRESHOLD) {
-			match_length = 1;  /* Not long enough match.  Send one byte. */
-			code_buf[0] |= mask;  /* 'send one byte' flag */
-			code_buf[code_buf_ptr++] = text_buf[r];  /* Send uncoded. */
-		} else {
-			code_buf[code_buf_ptr++] = (unsigned char) match_position;
-			code_buf[code_buf_ptr++] = (unsigned char)
-				(((match_position >> 4) & 0xf0)
-			  | (match_length - (THRESHOLD + 1)));  /* Send position and
-					length pair. Note match_length > THRESHOLD. */
-		}
-		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				str_out[part][codesize+i] = code_buf[i];     /* code together */
-			codesize += code_buf_ptr;
-			code_buf[0] = 0;  code_buf_ptr = mask = 1;
+	int n = huffDecodedSize(in, size), len = -1;
+	unsigned char *code;
+
+	if (n < 0 || n > FLZSS_BOUND(limit) || (code = (unsigned char *) poolTake(n + 1)) == NULL)
+		return -1;
+	if (huffDecode(in, size, code, n) == n) len = lz_decode(dict, dict_size, code, n, out, limit);
+	poolGive(code);
+	return len;
+}
+
+int decodeHuffman(const unsigned char *in, int size, unsigned char *out, int limit)
+{
+	return decodeHuffmanPrimed(NULL, 0, in, size, out, limit);
+}
+
+int openAppend(Container *c, FILE *fp, const MappedFile *input)
+	/* a: opens the container on fp to add the end of input to, after
+	   checking that its last chunk is where input has it (a file that was
+	   rotated or rewritten isn't the one it holds) */
+{
+	const ChunkEntry *last;
+
+	if (containerOpen(c, fp) != 0) return -1;
+	if ((c->flags & ~(0xff | CONTAINER_HUFFMAN)) != 0
+	 || flzssWindow(CONTAINER_FORMAT(c->flags)) == 0 || c->size > input->size) {
+		containerClose(c);  return -1;
+	}
+	if (c->chunks > 0) {
+		last = &c->table[c->chunks - 1];
+		if (last->usize > c->size
+		 || checksum(0, input->data + c->size - last->usize, last->usize) != last->crc) {
+			containerClose(c);  return -1;
 		}
-		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = str_in[textcount+offset]) != EOF && ++textcount <= upper; i++) {
-			DeleteNode(s);		/* Delete old strings and */
-			text_buf[s] = c;	/* read new bytes */
-			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
-				near the end of buffer, extend the buffer to make
-				string comparison easier. */
-			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
-				/* Since this is a ring buffer, increment the position
-				   modulo N. */
-			InsertNode(r);	/* Register the string in text_buf[r..r+F-1] */
+	}
+	return 0;
+}
+
+/* c and x: a stream of frames (flzss.h) on pipes.  The chunks are read and
+   coded in batches of STREAM_BATCH per worker; while one batch is coded on
+   the pool, the main thread reads the next one and writes the one before, so
+   no more than two batches are ever held. */
+typedef struct {
+	unsigned char *text, *code;
+	int len, csize;		/* bytes of text and of code */
+	unsigned int crc;
+	int failed;
+} Frame;
+
+typedef struct {
+	int threads, chunk_size;
+	FlzssEncoder **encoder;	/* of each worker (c) */
+	FlzssDecoder *decoder;	/* has no state, so one for all (x) */
+	int ended;		/* x: the end of the stream has been read */
+} Stream;
+
+typedef struct {
+	Stream *s;
+	Frame *frame;
+	int frames, room;
+	PoolTask task;
+	pthread_t tid;
+} Batch;
+
+static void put32(unsigned char *p, unsigned int v)
+{
+	p[0] = v;  p[1] = v >> 8;  p[2] = v >> 16;  p[3] = v >> 24;
+}
+
+static unsigned int get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+void encodeFrame(void *arg, int i, int worker)
+{
+	Batch *b = (Batch *) arg;
+	Frame *f = &b->frame[i];
+
+	f->crc = checksum(0, f->text, f->len);
+	f->csize = flzssCompressChunk(b->s->encoder[worker], f->text, f->len, f->code);
+}
+
+void decodeFrame(void *arg, int i, int worker)
+{
+	Batch *b = (Batch *) arg;
+	Frame *f = &b->frame[i];
+
+	(void) worker;
+	f->failed = flzssDecompressChunk(b->s->decoder, f->code, f->csize, f->text, f->len)
+			!= f->len || checksum(0, f->text, f->len) != f->crc;
+}
+
+void *codeBatch(void *arg)	/* the pool's run of one batch, on a thread of its own */
+{
+	Batch *b = (Batch *) arg;
+
+	if (poolRun(b->s->threads, b->frames, b->task, b) != 0) b->frames = -1;
+	return NULL;
+}
+
+int readText(Batch *b, FILE *fp)
+	/* c: up to a batch of chunks of text, the number read */
+{
+	for (b->frames = 0; b->frames < b->room; b->frames++) {
+		Frame *f = &b->frame[b->frames];
+		if ((f->len = (int) fread(f->text, 1, b->s->chunk_size, fp)) == 0) break;
+	}
+	return ferror(fp) ? -1 : b->frames;
+}
+
+int writeFrames(Batch *b, FILE *fp)
+{
+	unsigned char head[FLZSS_FRAME_HEAD];
+	int i;
+
+	for (i = 0; i < b->frames; i++) {
+		Frame *f = &b->frame[i];
+		put32(head, f->len);  put32(head + 4, f->csize);  put32(head + 8, f->crc);
+		if (fwrite(head, 1, sizeof(head), fp) != sizeof(head)
+		 || fwrite(f->code, 1, f->csize, fp) != (size_t) f->csize) return -1;
+	}
+	return 0;
+}
+
+int readFrames(Batch *b, FILE *fp)
+	/* x: up to a batch of frames, into buffers of their own sizes; -1 if the
+	   stream is damaged or ends without its end */
+{
+	unsigned char head[FLZSS_FRAME_HEAD];
+
+	for (b->frames = 0; b->frames < b->room && !b->s->ended; ) {
+		Frame *f = &b->frame[b->frames];
+		if (fread(head, 1, sizeof(head), fp) != sizeof(head)) return -1;
+		f->len = (int) get32(head);  f->csize = (int) get32(head + 4);  f->crc = get32(head + 8);
+		if (f->len == 0 && f->csize == 0) {
+			b->s->ended = 1;
+			return f->crc == 0 ? b->frames : -1;
 		}
-		if ((textsize += i) > printcount) {
-			/*printf("%12ld\r", textsize);*/  printcount += 1024;
-				/* Reports progress each time the textsize exceeds
-				   multiples of 1024. */
+		if ((unsigned int) f->len > FLZSS_MAX_FRAME || f->csize < 0
+		 || f->csize > FLZSS_BOUND(f->len)) return -1;
+		f->code = (unsigned char *) poolTake(f->csize + 1);
+		f->text = (unsigned char *) poolTake(f->len + 1);
+		b->frames++;	/* given back by writeText() */
+		if (f->code == NULL || f->text == NULL
+		 || fread(f->code, 1, f->csize, fp) != (size_t) f->csize) return -1;
+	}
+	return b->frames;
+}
+
+void giveFrames(Batch *b)	/* x: the buffers of a batch back to the pool */
+{
+	int i;
+
+	for (i = 0; i < b->frames; i++) {
+		poolGive(b->frame[i].code);  poolGive(b->frame[i].text);
+	}
+	b->frames = 0;
+}
+
+int writeText(Batch *b, FILE *fp)
+{
+	int i, status = 0;
+
+	for (i = 0; i < b->frames && status == 0; i++) {
+		Frame *f = &b->frame[i];
+		if (f->failed || fwrite(f->text, 1, f->len, fp) != (size_t) f->len) status = -1;
+	}
+	giveFrames(b);
+	return status;
+}
+
+int streamPipe(Batch b[2], FILE *in, FILE *out,
+		int (*get)(Batch *, FILE *), int (*put)(Batch *, FILE *))
+	/* b[cur] is coded while b[next] is read, and written while b[next] is
+	   coded in its turn.  Returns 0 once the input is used up. */
+{
+	int cur = 0, next, n, m;
+
+	if ((n = get(&b[cur], in)) > 0 && pthread_create(&b[cur].tid, NULL, codeBatch, &b[cur]) != 0)
+		n = -1;
+	while (n > 0) {
+		next = 1 - cur;
+		m = get(&b[next], in);
+		pthread_join(b[cur].tid, NULL);
+		if (b[cur].frames < 0) {	/* the pool couldn't start */
+			b[cur].frames = 0;  m = -1;
 		}
-		while (i++ < last_match_length) {	/* After the end of text, */
-			DeleteNode(s);					/* no need to read, but */
-			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
-			if (--len) InsertNode(r);		/* buffer may not be empty. */
+		if (m > 0 && pthread_create(&b[next].tid, NULL, codeBatch, &b[next]) != 0) m = -1;
+		if (put(&b[cur], out) != 0) {
+			if (m > 0) pthread_join(b[next].tid, NULL);
+			m = -1;
 		}
-	} while (len > 0);	/* until length of string to be processed is zero */
-	if (code_buf_ptr > 1) {		/* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++) str_out[part][codesize+i] = code_buf[i];
-		codesize += code_buf_ptr;
+		cur = next;  n = m;
 	}
-	printf("In : %ld bytes\n", textsize);	/* Encoding is done. */
-	printf("Out: %ld bytes\n", codesize);
-	printf("Out/In: %.3f\n", (double)codesize / textsize);
-	return codesize;
+	return n;
 }
 
-void Decode(FILE * in)	/* Just the reverse of Encode(). */
+static int streamBatches(Stream *st, Batch b[2], PoolTask task)
+	/* the two batches of st, STREAM_BATCH chunks per worker each */
 {
-	int  i, j, k, r, c;
-	unsigned int  flags;
-	
-	for (i = 0; i < N - F; i++) text_buf[i] = ' ';
-	r = N - F;  flags = 0;
-	for ( ; ; ) {
-		if (((flags >>= 1) & 256) == 0) {
-			if ((c = getc(in)) == EOF) break;
-			flags = c | 0xff00;		/* uses higher byte cleverly */
-		}							/* to count eight */
-		if (flags & 1) {
-			if ((c = getc(in)) == EOF) break;
-			putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
-		} else {
-			if ((i = getc(in)) == EOF) break;
-			if ((j = getc(in)) == EOF) break;
-			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
-			for (k = 0; k <= j; k++) {
-				c = text_buf[(i + k) & (N - 1)];
-				putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
-			}
+	int i;
+
+	st->threads = poolCores();
+	for (i = 0; i < 2; i++) {
+		b[i].s = st;  b[i].task = task;  b[i].frames = 0;
+		b[i].room = STREAM_BATCH * st->threads;
+		b[i].frame = (Frame *) calloc(b[i].room, sizeof(Frame));
+	}
+	return b[0].frame != NULL && b[1].frame != NULL ? 0 : -1;
+}
+
+int streamEncode(FILE *in, FILE *out, int format, int chain_depth, int level)
+	/* c: the text on in as a stream on out */
+{
+	unsigned char head[FLZSS_STREAM_HEAD] = { 'F', 'L', 'Z', 'F', 1, 0, 0, 0 };
+	unsigned char end[FLZSS_FRAME_HEAD] = { 0 };
+	int window = flzssWindow(format), i, j, status = -1, ready;
+	Stream st;
+	Batch b[2];
+
+	ready = streamBatches(&st, b, encodeFrame) == 0;
+	st.chunk_size = CHUNK_SIZE > 8 * window ? CHUNK_SIZE : 8 * window;
+	st.encoder = (FlzssEncoder **) calloc(st.threads, sizeof(FlzssEncoder *));
+	ready = ready && st.encoder != NULL;
+	for (i = 0; ready && i < st.threads; i++)
+		if ((st.encoder[i] = flzssEncoderCreate(format, chain_depth)) == NULL) ready = 0;
+		else flzssEncoderLevel(st.encoder[i], level);
+	for (i = 0; ready && i < 2; i++)
+		for (j = 0; j < b[i].room; j++) {
+			b[i].frame[j].text = (unsigned char *) poolTake(st.chunk_size);
+			b[i].frame[j].code = (unsigned char *) poolTake(FLZSS_BOUND(st.chunk_size));
+			if (b[i].frame[j].text == NULL || b[i].frame[j].code == NULL) ready = 0;
+		}
+
+	head[5] = (unsigned char) format;
+	if (ready && fwrite(head, 1, sizeof(head), out) == sizeof(head)
+	 && streamPipe(b, in, out, readText, writeFrames) == 0
+	 && fwrite(end, 1, sizeof(end), out) == sizeof(end) && fflush(out) == 0) status = 0;
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; b[i].frame != NULL && j < b[i].room; j++) {
+			poolGive(b[i].frame[j].text);  poolGive(b[i].frame[j].code);
 		}
+		free(b[i].frame);
 	}
+	for (i = 0; st.encoder != NULL && i < st.threads; i++) flzssEncoderFree(st.encoder[i]);
+	free(st.encoder);
+	return status;
 }
 
-void readFile(FILE * in){
-	int i = 0;
-	while(1){
-		char c = getc(in);
-		str_in[i++] = c;
-		if(c == EOF) break;
+int streamDecode(FILE *in, FILE *out)
+	/* x: the stream on in back to its text on out */
+{
+	unsigned char head[FLZSS_STREAM_HEAD];
+	int i, status = -1;
+	Stream st;
+	Batch b[2];
+
+	if (fread(head, 1, sizeof(head), in) != sizeof(head) || memcmp(head, "FLZF", 4) != 0
+	 || head[4] != 1 || (st.decoder = flzssDecoderCreate(head[5])) == NULL) return -1;
+	st.encoder = NULL;  st.ended = 0;
+	if (streamBatches(&st, b, decodeFrame) == 0
+	 && streamPipe(b, in, out, readFrames, writeText) == 0 && st.ended
+	 && fflush(out) == 0) status = 0;
+	for (i = 0; i < 2; i++) {
+		if (b[i].frame != NULL) giveFrames(&b[i]);
+		free(b[i].frame);
 	}
+	flzssDecoderFree(st.decoder);
+	return status;
 }
 
-void writeFile(FILE * out, int part, int size){
-	int i = 0;
-	while(i < size){
-		putc(str_out[part][i++], out);
+int trainDict(FILE *in, FILE *out, int format)
+	/* t: a dict for format from the lines of in, each one a sample, to out */
+{
+	MappedFile input;
+	size_t *sizes, i, a;
+	int count = 0, size = -1, capacity = flzssDictSize(format);
+	unsigned char *dict;
+
+	if (mapInput(&input, in) != 0) return -1;
+	for (i = 0; i < input.size; i++) count += input.data[i] == '\n';
+	sizes = (size_t *) malloc(sizeof(size_t) * (count + 1));
+	count = 0;
+	dict = (unsigned char *) malloc(capacity);
+	if (sizes != NULL && dict != NULL) {
+		for (i = a = 0; i < input.size; i++)
+			if (input.data[i] == '\n' || i + 1 == input.size) {
+				sizes[count++] = i + 1 - a;  a = i + 1;
+			}
+		size = flzssTrainDict(dict, capacity, input.data, sizes, count);
+		if (size >= 0 && fwrite(dict, 1, size, out) != (size_t) size) size = -1;
+		if (size >= 0) printf("%d samples, %lu bytes\nDict: %d bytes\n",
+				count, (unsigned long) input.size, size);
 	}
-	putc(EOF, out);
+	free(sizes);  free(dict);
+	unmapFile(&input);
+	return size < 0 ? -1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
-	char  *s, *in;
+	char  *s, *in, *window = NULL;
+	int  i, j, chain_depth = 0, format = CONTAINER_FORMAT_4K, huffman = 0, stats = 0;
+	int  level = FLZSS_LEVEL_GREEDY, prime = 0, append, pipes;
 	
-	if (argc != 4) {
-		printf("'lzss e file1 file2' encodes file1 into file2.\n"
-			   "'lzss d file2 file1' decodes file2 into file1.\n");
+	for (i = j = 1; i < argc; i++)	/* options go anywhere */
+		if (strcmp(argv[i], "--huffman") == 0) huffman = 1;
+		else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+		else if (strcmp(argv[i], "--prime") == 0) prime = 1;
+		else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) {
+			level = atoi(argv[++i]);
+			if (level < FLZSS_LEVEL_GREEDY || level > FLZSS_LEVEL_OPTIMAL
+			 || !isdigit((unsigned char) *argv[i])) {
+				printf("??? --level %s\n", argv[i]);  return EXIT_FAILURE;
+			}
+		}
+		else argv[j++] = argv[i];
+	argv[argc = j] = NULL;
+	if (argc < 4 || argc > (strchr("HhRr", *argv[1]) ? 6 : strchr("EeCcTt", *argv[1]) ? 5 : 4)
+	 || (toupper(*argv[1]) == 'R' && (argc != 6 || !isdigit((unsigned char) *argv[4])
+			|| !isdigit((unsigned char) *argv[5])))) {
+		printf("'lzss e file1 file2 [window]' encodes file1 into file2.\n"
+			   "'lzss h file1 file2 [depth [window]]' same as e, but searches hash\n"
+			   "                            chains depth candidates deep (default %d):\n"
+			   "                            faster when small, smaller when large.\n"
+			   "'lzss a file1 file2' adds what file1 has gained since file2 was\n"
+			   "                     made from it to file2, as new chunks.\n"
+			   "                     --prime starts the first one's window on\n"
+			   "                     the text before it (smaller for small appends).\n"
+			   "'lzss d file2 file1' decodes file2 into file1.\n"
+			   "'lzss r file2 file1 offset length' decodes only length bytes from\n"
+			   "                     offset on, from the parts that hold them.\n"
+			   "'lzss c file1 file2 [window]' same as e, but as a stream of frames\n"
+			   "                     that need no seeking, - for stdin or stdout:\n"
+			   "                     tar c dir | lzss c - - | ssh host lzss x - -\n"
+			   "'lzss x file2 file1' decodes such a stream.\n"
+			   "'lzss t file1 file2 [window]' trains a dict for flzssDictCreate() on\n"
+			   "                     the lines of file1, e.g. messages, into file2.\n"
+			   "window is 4k (the default), 64k or 1m.\n"
+			   "--huffman also Huffman codes the code of every chunk (e and h).\n"
+			   "--stats prints the times and search counts of every chunk (e, h and a).\n"
+			   "--level 1 puts a match off by a byte when the next one is longer,\n"
+			   "          --level 2 chooses the cheapest matches of each block of\n"
+			   "          4096 (e and h): slower, smaller, and d decodes them the same.\n",
+			   CHAIN_DEPTH);
 		return EXIT_FAILURE;
 	}
-	if ((s = argv[1], s[1] || strpbrk(s, "DEde") == NULL)
-	 || (s = argv[2], in = argv[2], (infile  = fopen(s, "rb")) == NULL)
-	 || (s = argv[3], (outfile = fopen(s, "wb")) == NULL)) {
+	append = toupper(*argv[1]) == 'A';
+	pipes = strchr("CcXx", *argv[1]) != NULL;
+	if ((s = argv[1], s[1] || strpbrk(s, "ACDEHRTXacdehrtx") == NULL)
+	 || (s = argv[2], in = argv[2], (infile = pipes && strcmp(s, "-") == 0 ? stdin
+			: fopen(s, "rb")) == NULL)
+	 || (s = argv[3], (outfile = pipes && strcmp(s, "-") == 0 ? stdout
+			: fopen(s, append ? "r+b" : pipes ? "wb" : "w+b")) == NULL)) {
 		printf("??? %s\n", s);  return EXIT_FAILURE;
 	}
-	if (toupper(*argv[1]) == 'E'){
+	if (toupper(*argv[1]) == 'H') {
+		chain_depth = argc >= 5 ? atoi(argv[4]) : CHAIN_DEPTH;
+		if (chain_depth < 1) {
+			printf("??? %s\n", argv[4]);  return EXIT_FAILURE;
+		}
+		if (argc == 6) window = argv[5];
+	} else if (argc == 5) window = argv[4];
+	if (window != NULL) {
+		if ((format = flzssFormat(window)) < 0) {
+			printf("??? %s\n", window);  return EXIT_FAILURE;
+		}
+	}
+	if (toupper(*argv[1]) == 'T') {
+		if (trainDict(infile, outfile, format) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+	} else if (pipes) {	/* nothing but the stream goes to stdout */
+		if (toupper(*argv[1]) == 'C' ? streamEncode(infile, outfile, format, 0, level) != 0
+		 : streamDecode(infile, outfile) != 0) {
+			fprintf(stderr, "??? %s\n", ferror(outfile) ? argv[3] : in);  return EXIT_FAILURE;
+		}
+	} else if (strchr("DdRr", *argv[1]) == NULL){
 		time_t start = time(NULL);
 		printf("\nStart time: %ld\n", start);
-		pid_t pids[PARTITIONS];
-		stat(argv[2], &st);
-		int size = st.st_size;
-		createStringOfSize(size);
-		printf("%d\n",size);
-		int part = 0, seeksize = size/PARTITIONS;
-		remove(s);
-		readFile(infile);
-		for(part = 0; part < PARTITIONS; part++){
-			int pid =fork();
-			if(pid > 0) {
-				pids[part] = pid;
-				continue;
-			} else {
-				//chdir(path);
-				//FILE * infile_part = fopen(in, "rb");
-				//fseek(infile_part, seeksize*part, SEEK_SET);
-				//printf("%.2f%%\n",part/(float)PARTITIONS);
-				//printf("\n\nPart: %d\n\n", part);
-				sprintf(s,"%s.%d",s,part);
-				FILE * out = fopen(s, "wb");
-				s[strlen(s)-2] = '\0';
-				//nice(-15);
-				int encSize = Encode(seeksize+(part==PARTITIONS ? size%PARTITIONS:0), part, size/PARTITIONS * part);
-				writeFile(out, part, encSize);
-				return EXIT_SUCCESS;
+		MappedFile input;
+		double map = seconds();
+		if (mapInput(&input, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+		map = seconds() - map;
+		size_t size = input.size;
+		printf("%llu\n", (unsigned long long) size);
+		/* chunks of up to a fixed size, taken by one worker thread per core; a
+		   wide window needs long chunks to pay off */
+		EncodeJob job;
+		Container c;
+		job.base = job.first = 0;
+		if (append) {	/* only the bytes after base, in new chunks */
+			if (openAppend(&c, outfile, &input) != 0) {
+				printf("??? %s doesn't hold the start of %s\n", s, in);
+				return EXIT_FAILURE;
 			}
+			format = CONTAINER_FORMAT(c.flags);
+			huffman = (c.flags & CONTAINER_HUFFMAN) != 0;
+			job.base = (size_t) c.size;  job.first = c.chunks;
+		}
+		job.prime = prime && job.base > 0;
+		int window_size = flzssWindow(format);
+		job.chunk_size = CHUNK_SIZE > 8 * window_size ? CHUNK_SIZE : 8 * window_size;
+		job.in = input.data;  job.size = size;
+		int part, chunks = planChunks(&job);
+		if (chunks < 0) {
+			printf("??? out of memory\n");  return EXIT_FAILURE;
 		}
-		for(part = 0; part < PARTITIONS; part++) {
-			if(pids[part] > 0) {
-				printf("\n\nWaiting on part: %d\n\n", part);
-				waitpid(pids[part], NULL, 0);
+		int threads = poolThreads(0, chunks);
+		job.c = &c;
+		job.codesize = 0;  job.failed = 0;
+		job.stats = stats ? (ChunkStats *) calloc(chunks + 1, sizeof(ChunkStats)) : NULL;
+		if (stats && job.stats == NULL) {
+			printf("??? out of memory\n");  return EXIT_FAILURE;
+		}
+		job.encoder = (FlzssEncoder **) malloc (sizeof(FlzssEncoder *) * threads);
+		job.out = (unsigned char **) malloc (sizeof(unsigned char *) * threads);
+		job.lz = huffman ? (unsigned char **) malloc (sizeof(unsigned char *) * threads) : NULL;
+		for(part = 0; part < threads; part++) {
+			if ((job.encoder[part] = flzssEncoderCreate(format, chain_depth)) != NULL)
+				flzssEncoderLevel(job.encoder[part], level);
+			job.out[part] = (unsigned char *) poolTake(HUFF_BOUND(FLZSS_BOUND(job.chunk_size)));
+			if (huffman) job.lz[part] = (unsigned char *) poolTake(FLZSS_BOUND(job.chunk_size));
+			if (job.encoder[part] == NULL || job.out[part] == NULL
+			 || (huffman && job.lz[part] == NULL)) {
+				printf("??? out of memory\n");  return EXIT_FAILURE;
 			}
 		}
+		pthread_mutex_init(&job.lock, NULL);
+		if (append ? containerAppend(&c, chunks) != 0 : containerCreate(&c, outfile, chunks) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		c.flags = format | (huffman ? CONTAINER_HUFFMAN : 0);
+		if (poolRun(threads, chunks, encodeTask, &job) != 0 || job.failed
+		 || containerFinish(&c) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		pthread_mutex_destroy(&job.lock);
+		for(part = 0; part < threads; part++) {
+			flzssEncoderFree(job.encoder[part]);  poolGive(job.out[part]);
+			if (huffman) poolGive(job.lz[part]);
+		}
+		if (stats) printStats(job.stats, chunks, map);
+		free(job.encoder);  free(job.out);  free(job.lz);  free(job.stats);
+		free(job.start);  free(job.raw);
+		unmapFile(&input);
+		printf("In : %llu bytes\n", (unsigned long long) (size - job.base));	/* Encoding is done. */
+		printf("Out: %ld bytes\n", job.codesize);
+		if (size > job.base) printf("Out/In: %.3f\n", (double)job.codesize / (size - job.base));
 		time_t end = time(NULL);// - start;
 		printf("\nEnd time: %ld\n", end);
 		printf("\nTime taken: %f\n",difftime(end, start));
 		//int msec = diff * 1000 / CLOCKS_PER_SEC;
 		//printf("Time taken %d seconds %d milliseconds\n", msec/1000, msec%1000);
 	} else {
-		int part = 0;
-		for(part = 0; part < PARTITIONS; part++){
-			in[strlen(in)-2] = '\0';
-			sprintf(in,"%s.%d",in,part);
-			printf("%s\n",in);
-			FILE * inf = fopen(in, "rb");
-			Decode(inf);
-			fclose(inf);
+		/* every part is decoded at once, straight into its place in text */
+		Container c;
+		unsigned int bad = 0;
+		ChunkDecoder decode;
+		PrimedDecoder primed;
+		if (containerOpen(&c, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+		if ((c.flags & ~(0xff | CONTAINER_HUFFMAN)) != 0
+		 || (decode = flzssChunkDecoder(CONTAINER_FORMAT(c.flags))) == NULL) {
+			printf("??? %s: unknown format %#x\n", in, c.flags);  return EXIT_FAILURE;
+		}
+		primed = flzssPrimedDecoder(CONTAINER_FORMAT(c.flags));
+		if (c.flags & CONTAINER_HUFFMAN) {
+			lz_decode = primed;  decode = decodeHuffman;  primed = decodeHuffmanPrimed;
+		}
+		if (toupper(*argv[1]) == 'R') {	/* only the parts holding the range */
+			unsigned long long offset = strtoull(argv[4], NULL, 10);
+			size_t len = strtoull(argv[5], NULL, 10);
+			unsigned char *range = (unsigned char *) malloc(len + 1);
+			if (range == NULL || offset > c.size || len > c.size - offset) {
+				printf("??? %s is %llu bytes\n", in, c.size);  return EXIT_FAILURE;
+			}
+			if (containerDecodeRange(&c, offset, len, range, 0, decode, primed, &bad) != 0) {
+				if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+				else printf("??? %s\n", in);
+				return EXIT_FAILURE;
+			}
+			if (fwrite(range, 1, len, outfile) != len) {
+				printf("??? %s\n", s);  return EXIT_FAILURE;
+			}
+			free(range);  containerClose(&c);
+			fclose(infile);  fclose(outfile);
+			return EXIT_SUCCESS;
+		}
+		MappedFile text;  /* the parts are decoded straight into the output file */
+		if (mapOutput(&text, outfile, c.size) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		if (containerDecodeAllPrimed(&c, text.data, 0, decode, primed, &bad) != 0) {
+			if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+			else printf("??? %s\n", in);
+			return EXIT_FAILURE;
+		}
+		if (unmapFile(&text) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
 		}
+		containerClose(&c);
 	}
 	fclose(infile);  fclose(outfile);
 	return EXIT_SUCCESS;
@@ -16,12 +16,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h> 
 #include <time.h>
+#include <pthread.h>
 #include "helpers.cuh"
+#include "container.h"
+#include "flzss.h"
+#include "pool.h"
+#include "mapfile.h"
+#include "../huffman_coding/huffman.h"
 
 #define N		 4096	/* size of ring buffer */
 #define F		   18	/* upper limit for match_length */
@@ -31,18 +38,47 @@
 
 #define PARTITIONS 8
 
+#define GRID_THREADS		64	/* threads per block in grid mode */
+#define GRID_BLOCKS_PER_SM	4	/* blocks to keep resident on each SM */
+#define GRID_MIN_CHUNK	(64 * 1024)	/* smallest chunk given to one thread */
+#define WARP_CHUNKS_PER_BLOCK	4	/* warps (one per chunk) per block in warp mode */
+#define WARP_CHUNKS_PER_SM	64	/* warps to keep resident on each SM */
+#define SCAN_THREADS	256	/* threads of the one block that sums the code sizes */
+#define COMPACT_THREADS	128	/* threads per chunk when packing its code */
+#define HIST_THREADS	256	/* threads per chunk when counting its code */
+#define STREAM_SEGMENT	(64 * 1024 * 1024)	/* input bytes of one segment in stream mode */
+#define STREAM_SLOTS	3	/* segments in flight: upload and encode, download, write */
+#define TIMED_STAGES	3	/* upload, kernels, download */
+#define HYBRID_CHUNK	GRID_MIN_CHUNK	/* chunk size in the b and m modes, for every side */
+#define HYBRID_BATCH	STREAM_SEGMENT	/* most input bytes a device takes at once there */
+#define CODED_BOUND(n)	((n) + (n) / 8 + 9)	/* worst case code size of
+						   n input bytes (all literals) */
+
+typedef struct {
+	unsigned short lson[N + 1], rson[N + 257], dad[N + 1];  /* same trees as
+		the int arrays in EncodeCUDA, but N + 256 fits in 16 bits */
+	unsigned char text_buf[N + F - 1];
+} CompactTree;  /* per-chunk search state of the grid mode, ~29 KB instead
+		of ~54 KB of spilled local memory */
+
 FILE	*infile, *outfile;  /* input & output files */
 
 struct stat st; /* to get file size */
-void createStringOfSize(int size, char * str_in[], char ** str_out[]){
-	*str_in = (char *) malloc (size);
-	int i;
-	for(i=0; i<PARTITIONS; i++){
-		*str_out[i] = (char *) malloc (size/PARTITIONS + size%PARTITIONS);
-	}
-}
 
-__device__ void InitTree(int lson[], int rson[], int dad[])  /* initialize trees */
+cudaEvent_t stage_mark[TIMED_STAGES + 1]; /* recorded as each timed stage ends */
+
+typedef struct {
+    const char * name;
+    cudaEvent_t start, stop;
+} KernelTime;  /* one launch timed for --stats */
+
+KernelTime * kernel_time = NULL; /* every launch so far, only with --stats */
+int kernels_timed = 0, kernel_room = 0, show_stats = 0;
+pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER; /* held from kernelStart to
+		kernelStop, as the b and m modes launch from one thread per device */
+
+template <typename T>
+__device__ void InitTree(T lson[], T rson[], T dad[])  /* initialize trees */
 {
 	int  i;
 
@@ -58,7 +94,8 @@ __device__ void InitTree(int lson[], int rson[], int dad[])  /* initialize trees
 	for (i = 0; i < N; i++) dad[i] = NIL;
 }
 
-__device__ void InsertNode(int r, int lson[], int rson[], int dad[], int *match_position, int *match_length, unsigned char
+template <typename T>
+__device__ void InsertNode(int r, T lson[], T rson[], T dad[], int *match_position, int *match_length, unsigned char
 		text_buf[]) 
 	/* Inserts string of length F, text_buf[r..r+F-1], into one of the
 	   trees (text_buf[r]'th tree) and returns the longest-match position
@@ -94,7 +131,8 @@ __device__ void InsertNode(int r, int lson[], int rson[], int dad[], int *match_
 	dad[p] = NIL;  /* remove p */
 }
 
-__device__ void DeleteNode(int p, int lson[], int rson[], int dad[])  /* deletes node p from tree */
+template <typename T>
+__device__ void DeleteNode(int p, T lson[], T rson[], T dad[])  /* deletes node p from tree */
 {
 	int  q;
 	
@@ -114,33 +152,25 @@ __device__ void DeleteNode(int p, int lson[], int rson[], int dad[])  /* deletes
 	if (rson[dad[p]] == p) rson[dad[p]] = q;  else lson[dad[p]] = q;
 	dad[p] = NIL;
 }
-           
-__global__ void EncodeCUDA(int size, char * str_in, char * str_out, int *sizes)
+
+template <typename T>
+__device__ int EncodeChunk(const unsigned char * in, int upper, unsigned char * out,
+		T lson[], T rson[], T dad[], unsigned char text_buf[])
+	/* Encodes in[0..upper-1] into out and returns the number of code bytes
+	   written.  The trees and the ring buffer are supplied by the caller so
+	   that the per-thread and the grid kernels share the same body. */
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
- 
-	int part = threadIdx.x;  
-	int seeksize = size/PARTITIONS;
-	int upper = seeksize+(part==PARTITIONS ? size%PARTITIONS:0);
-	int offset = (size/PARTITIONS) * part;
 	
 	int match_position, match_length;  /* of longest match.  These are
 			set by the InsertNode() procedure. */	
-	int lson[N + 1], 
-			rson[N + 257], 
-			dad[N + 1];  /* left & right children &
-				parents -- These constitute binary search trees. */
-			
-	unsigned char text_buf[N + F - 1];	/* ring buffer of size N,
-			with extra F-1 bytes to facilitate string comparison */
 			
 	unsigned char  code_buf[17], mask;	
 	
 	unsigned long int
 			textsize = 0,	/* text size counter */
 			textcount = 0,	/* second text size counter */
-			codesize = 0,	/* code size counter */
-			printcount = 0;	/* counter for reporting progress every 1K bytes */
+			codesize = 0;	/* code size counter */
 	
 	InitTree(lson, rson, dad);  /* initialize trees */
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
@@ -151,13 +181,10 @@ __global__ void EncodeCUDA(int size, char * str_in, char * str_out, int *sizes)
 	s = 0;  r = N - F;
 	for (i = s; i < r; i++) text_buf[i] = ' ';  /* Clear the buffer with
 		any character that will appear often. */
-	for (len = 0; len < F && (c = str_in[textcount+offset]) != EOF && ++textcount <= upper; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
+	for (len = 0; len < F && textcount < upper; len++)
+		text_buf[r + len] = in[textcount++];  /* Read F bytes into the last F bytes of
 			the buffer */
-	if ((textsize = len) == 0) {
-		sizes[part] = 0;
-		return;  /* text of size zero */
-	}
+	if ((textsize = len) == 0) return 0;  /* text of size zero */
 	for (i = 1; i <= F; i++) InsertNode(r - i, lson, rson, dad, &match_position, &match_length, text_buf);  /* Insert the F strings,
 		each of which begins with one or more 'space' characters.  Note
 		the order in which these strings are inserted.  This way,
@@ -180,13 +207,13 @@ __global__ void EncodeCUDA(int size, char * str_in, char * str_out, int *sizes)
 		}
 		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
 			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				str_out[codesize+i+offset] = code_buf[i];     /* code together */
+				out[codesize+i] = code_buf[i];     /* code together */
 			codesize += code_buf_ptr;
 			code_buf[0] = 0;  code_buf_ptr = mask = 1;
 		}
 		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = str_in[textcount+offset]) != EOF && ++textcount <= upper; i++) {
+		for (i = 0; i < last_match_length && textcount < upper; i++) {
+			c = in[textcount++];
 			DeleteNode(s, lson, rson, dad);		/* Delete old strings and */
 			text_buf[s] = c;	/* read new bytes */
 			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
@@ -197,11 +224,7 @@ __global__ void EncodeCUDA(int size, char * str_in, char * str_out, int *sizes)
 				   modulo N. */
 			InsertNode(r, lson, rson, dad, &match_position, &match_length, text_buf);	/* Register the string in text_buf[r..r+F-1] */
 		}
-		if ((textsize += i) > printcount) {
-			/*printf("%12ld\r", textsize);*/  
-			printcount += 1024; /* Reports progress each time the textsize exceeds
-				   multiples of 1024. */
-		}
+		textsize += i;
 		while (i++ < last_match_length) {	/* After the end of text, */
 			DeleteNode(s, lson, rson, dad);					/* no need to read, but */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
@@ -210,20 +233,233 @@ __global__ void EncodeCUDA(int size, char * str_in, char * str_out, int *sizes)
 	} while (len > 0);	/* until length of string to be processed is zero */
 	if (code_buf_ptr > 1) {		/* Send remaining code. */
 		for (i = 0; i < code_buf_ptr; i++){
-      str_out[codesize+i+offset] = code_buf[i];
+      out[codesize+i] = code_buf[i];
     }
 		codesize += code_buf_ptr;
 	}
 	//printf("In : %ld bytes\n", textsize);	/* Encoding is done. */
 	//printf("Out: %ld bytes\n", codesize);
 	//printf("Out/In: %.3f\n", (double)codesize / textsize);
-	sizes[part] = codesize;
+	return codesize;
 }
 
-// TODO: global >> no branches - no cuda for the moment
-void Decode(FILE * in)	/* Just the reverse of Encode(). */
+__global__ void EncodeCUDA(int size, int out_stride, char * str_in, char * str_out, int *sizes)
 {
-	int  i, j, k, r, c;
+	int part = threadIdx.x;  
+	int seeksize = size/PARTITIONS;
+	int upper = seeksize+(part==PARTITIONS-1 ? size%PARTITIONS:0);
+	int offset = (size/PARTITIONS) * part;
+	
+	int lson[N + 1], 
+			rson[N + 257], 
+			dad[N + 1];  /* left & right children &
+				parents -- These constitute binary search trees. */
+			
+	unsigned char text_buf[N + F - 1];	/* ring buffer of size N,
+			with extra F-1 bytes to facilitate string comparison */
+
+	sizes[part] = EncodeChunk((unsigned char *) str_in + offset, upper,
+			(unsigned char *) str_out + (size_t) out_stride * part, lson, rson, dad, text_buf);
+}
+
+/* Grid mode: one thread per chunk, as many chunks as the input size and
+   the device allow (see gridChunkSize()).  Chunk part reads
+   str_in[part * chunk_size ..] and writes its code to
+   str_out[part * out_stride ..]; trees[] holds one CompactTree per chunk. */
+__global__ void EncodeCUDAGrid(int size, int chunk_size, int chunks, int out_stride,
+		char * str_in, char * str_out, int *sizes, CompactTree *trees)
+{
+	int part = blockIdx.x * blockDim.x + threadIdx.x;
+	if (part >= chunks) return;
+
+	int offset = chunk_size * part;
+	int upper = min(chunk_size, size - offset);
+	CompactTree *t = &trees[part];
+
+	sizes[part] = EncodeChunk((unsigned char *) str_in + offset, upper,
+			(unsigned char *) str_out + (size_t) out_stride * part,
+			t->lson, t->rson, t->dad, t->text_buf);
+}
+
+__device__ void FindMatchWarp(const unsigned char text_buf[], int r, int s, int lane,
+		int *match_position, int *match_length)
+	/* Warp replacement for InsertNode(): all 32 lanes compare the F bytes
+	   at text_buf[r] against the N - F strings starting at s..r-1 (lane l
+	   takes candidates l, l + 32, ...) and the warp reduces to the longest
+	   match, ties going to the most recent string.  Every lane gets the
+	   same match_position and match_length, with the same meaning as
+	   InsertNode()'s, so Decode() needs no change.  Indices wrap modulo N,
+	   so the ring buffer needs no extra F - 1 bytes and no tree. */
+{
+	unsigned char key[F];
+	int i, j, k, p, len, run, best = 0;
+
+	#pragma unroll
+	for (k = 0; k < F; k++) key[k] = text_buf[(r + k) & (N - 1)];
+	for (j = lane; j < N - F; j += warpSize) {
+		p = (s + j) & (N - 1);
+		if (text_buf[p] != key[0]) continue;
+		len = run = 1;
+		#pragma unroll
+		for (k = 1; k < F; k++) {  /* no early exit, the compare is */
+			run &= text_buf[(p + k) & (N - 1)] == key[k];  /* predicated */
+			len += run;
+		}
+		if ((len << 16 | j) > best) best = len << 16 | j;
+	}
+	for (i = warpSize / 2; i > 0; i >>= 1) {
+		k = __shfl_xor_sync(0xffffffff, best, i);
+		if (k > best) best = k;
+	}
+	*match_length = best >> 16;
+	*match_position = (s + (best & 0xffff)) & (N - 1);
+}
+
+/* Warp mode: one warp per chunk, same chunk layout as EncodeCUDAGrid().
+   The ring buffer lives in shared memory and FindMatchWarp() replaces the
+   trees; lane 0 packs the code while all lanes slide the window. */
+__global__ void EncodeCUDAWarp(int size, int chunk_size, int chunks, int out_stride,
+		char * str_in, char * str_out, int *sizes)
+{
+	__shared__ unsigned char ring[WARP_CHUNKS_PER_BLOCK][N];
+	int lane = threadIdx.x % warpSize, warp = threadIdx.x / warpSize;
+	int part = blockIdx.x * WARP_CHUNKS_PER_BLOCK + warp;
+	if (part >= chunks) return;  /* whole warp leaves together */
+
+	const unsigned char *in = (unsigned char *) str_in + (size_t) chunk_size * part;
+	unsigned char *out = (unsigned char *) str_out + (size_t) out_stride * part;
+	unsigned char *text_buf = ring[warp];
+	int upper = min(chunk_size, size - chunk_size * part);
+	int  i, len, r, s, textcount, codesize = 0, code_buf_ptr;
+	int match_position, match_length;
+	unsigned char  code_buf[17], mask;
+
+	code_buf[0] = 0;  code_buf_ptr = mask = 1;
+	s = 0;  r = N - F;
+	for (i = lane; i < r; i += warpSize) text_buf[i] = ' ';
+	len = min(F, upper);
+	for (i = lane; i < len; i += warpSize) text_buf[r + i] = in[i];
+	textcount = len;
+	__syncwarp();
+	while (len > 0) {
+		FindMatchWarp(text_buf, r, s, lane, &match_position, &match_length);
+		if (match_length > len) match_length = len;
+		if (match_length <= THRESHOLD) match_length = 1;
+		if (lane == 0) {
+			if (match_length == 1) {
+				code_buf[0] |= mask;
+				code_buf[code_buf_ptr++] = text_buf[r];
+			} else {
+				code_buf[code_buf_ptr++] = (unsigned char) match_position;
+				code_buf[code_buf_ptr++] = (unsigned char)
+					(((match_position >> 4) & 0xf0)
+				  | (match_length - (THRESHOLD + 1)));
+			}
+			if ((mask <<= 1) == 0) {
+				for (i = 0; i < code_buf_ptr; i++) out[codesize + i] = code_buf[i];
+				codesize += code_buf_ptr;
+				code_buf[0] = 0;  code_buf_ptr = mask = 1;
+			}
+		}
+		__syncwarp();  /* everyone is done reading before s.. is reused */
+		for (i = lane; i < match_length && textcount + i < upper; i += warpSize)
+			text_buf[(s + i) & (N - 1)] = in[textcount + i];
+		i = min(match_length, upper - textcount);  /* bytes actually read */
+		textcount += i;  len -= match_length - i;
+		s = (s + match_length) & (N - 1);  r = (r + match_length) & (N - 1);
+		__syncwarp();
+	}
+	if (lane == 0) {
+		if (code_buf_ptr > 1) {
+			for (i = 0; i < code_buf_ptr; i++) out[codesize + i] = code_buf[i];
+			codesize += code_buf_ptr;
+		}
+		sizes[part] = codesize;
+	}
+}
+
+/* Picks the chunk size for the grid and warp modes.  The aim is
+   per_sm chunks on each SM of the current device (one per thread in grid
+   mode, one per warp in warp mode), but chunks never get smaller than
+   GRID_MIN_CHUNK so small inputs still compress reasonably. */
+int gridChunkSize(int size, int per_sm)
+{
+	int dev;
+	cudaDeviceProp prop;
+	long threads, chunk_size;
+
+	checkCuda(cudaGetDevice(&dev));
+	checkCuda(cudaGetDeviceProperties(&prop, dev));
+	threads = (long) prop.multiProcessorCount * per_sm;
+	chunk_size = (size + threads - 1) / threads;
+	if (chunk_size < GRID_MIN_CHUNK) chunk_size = GRID_MIN_CHUNK;
+	return (int) chunk_size;
+}
+
+/* Exclusive prefix sum of the code sizes: chunk i's code goes to
+   starts[i] of the packed run, and starts[chunks] is the whole run.  One
+   block; each thread sums its own run of chunks, the block scans the run
+   totals, and each thread then fills in its own run. */
+__global__ void ScanSizes(int chunks, const int * sizes, unsigned long long * starts)
+{
+	__shared__ unsigned long long sums[SCAN_THREADS];
+	int t = threadIdx.x, per = (chunks + SCAN_THREADS - 1) / SCAN_THREADS;
+	int i, d, first = t * per, last = min(first + per, chunks);
+	unsigned long long sum = 0, x;
+
+	for (i = first; i < last; i++) sum += sizes[i];
+	sums[t] = sum;
+	__syncthreads();
+	for (d = 1; d < SCAN_THREADS; d <<= 1) {  /* inclusive scan of the totals */
+		x = t >= d ? sums[t - d] : 0;
+		__syncthreads();
+		sums[t] += x;
+		__syncthreads();
+	}
+	sum = sums[t] - sum;  /* what the runs before this one hold */
+	for (i = first; i < last; i++) {
+		starts[i] = sum;  sum += sizes[i];
+	}
+	if (t == SCAN_THREADS - 1) starts[chunks] = sums[t];
+}
+
+/* One block per chunk: moves the code of chunk part from its slot at
+   str_out + out_stride * part to packed + starts[part]. */
+__global__ void CompactCode(int out_stride, const char * str_out, const int * sizes,
+		const unsigned long long * starts, unsigned char * packed)
+{
+	int part = blockIdx.x, i;
+	const unsigned char *from = (const unsigned char *) str_out + (size_t) out_stride * part;
+	unsigned char *to = packed + starts[part];
+
+	for (i = threadIdx.x; i < sizes[part]; i += blockDim.x) to[i] = from[i];
+}
+
+/* One block per chunk: counts the bytes of chunk part's packed code into
+   bins in shared memory, which only the block's own threads touch, and
+   then stores them in freq[256 * part ..]. */
+__global__ void HistogramCUDA(const unsigned char * packed, const unsigned long long * starts,
+		unsigned int * freq)
+{
+	__shared__ unsigned int bins[256];
+	int part = blockIdx.x, i;
+	unsigned long long p;
+
+	for (i = threadIdx.x; i < 256; i += blockDim.x) bins[i] = 0;
+	__syncthreads();
+	for (p = starts[part] + threadIdx.x; p < starts[part + 1]; p += blockDim.x)
+		atomicAdd(&bins[packed[p]], 1u);
+	__syncthreads();
+	for (i = threadIdx.x; i < 256; i += blockDim.x) freq[256 * part + i] = bins[i];
+}
+
+// host: one part per pool thread ('d'); DecodeCUDAWarp() is the device's ('u')
+int Decode(const unsigned char *in, int size, unsigned char *out, int limit)
+	/* Just the reverse of Encode().  Decodes the size bytes of code at in
+	   into out, never writing more than limit bytes, and returns the
+	   number of bytes written. */
+{
+	int  i, j, k, r, c, pos = 0, n = 0;
 	unsigned int flags;
 	
 	unsigned char text_buf[N + F - 1];	/* ring buffer of size N,
@@ -233,63 +469,809 @@ void Decode(FILE * in)	/* Just the reverse of Encode(). */
 	r = N - F;  flags = 0;
 	for ( ; ; ) {
 		if (((flags >>= 1) & 256) == 0) { 
-			if ((c = getc(in)) == EOF) break;
-			flags = c | 0xff00;		/* uses higher byte cleverly */
+			if (pos >= size) break;
+			flags = in[pos++] | 0xff00;		/* uses higher byte cleverly */
 		}							/* to count eight */
 		if (flags & 1) {
-			if ((c = getc(in)) == EOF) break;
-			putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+			if (pos >= size || n >= limit) break;
+			c = in[pos++];
+			out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 		} else {
-			if ((i = getc(in)) == EOF) break;
-			if ((j = getc(in)) == EOF) break;
+			if (pos + 1 >= size) break;
+			i = in[pos++];  j = in[pos++];
 			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
+			if (n + j >= limit) break;
 			for (k = 0; k <= j; k++) {
 				c = text_buf[(i + k) & (N - 1)];
-				putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+				out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 			}
 		}
 	}
+	return n;
 }
 
-//cpu
-void readFile(FILE * in, char * str_in){
-	int i = 0;
-	while(1){
-		char c = getc(in);
-		str_in[i++] = c;
-		if(c == EOF) break;
+/* GPU decode: one warp per part, WARP_CHUNKS_PER_BLOCK parts per block.
+   Part part's code is code[code_start[part] .. code_start[part + 1]) and it
+   decodes into text[text_start[part] .. text_start[part + 1]), the same
+   bytes (and lengths[part]) as Decode().  The ring buffer lives in shared
+   memory.  Lanes 0..7 each read one of the 8 items of a flag byte at once
+   (an item's place follows from the flags alone) and a scan of their
+   lengths says where its bytes go; the items then go into the ring in
+   order, the bytes of a pair copied by as many lanes, and the group's
+   output leaves the ring for text in one coalesced copy. */
+__global__ void DecodeCUDAWarp(int chunks, const unsigned char * code, const unsigned long long * code_start,
+		unsigned char * text, const unsigned long long * text_start, int * lengths)
+{
+	__shared__ unsigned char ring[WARP_CHUNKS_PER_BLOCK][N];
+	int lane = threadIdx.x % warpSize, warp = threadIdx.x / warpSize;
+	int part = blockIdx.x * WARP_CHUNKS_PER_BLOCK + warp;
+	if (part >= chunks) return;  /* whole warp leaves together */
+
+	const unsigned char *in = code + code_start[part];
+	unsigned char *out = text + text_start[part];
+	unsigned char *text_buf = ring[warp];
+	int size = (int) (code_start[part + 1] - code_start[part]);
+	int limit = (int) (text_start[part + 1] - text_start[part]);
+	int  i, j, k, t, d, at, len, end, from, to, items, total, lit = 0, pos = 0, n = 0, r = N - F;
+	unsigned char b = 0;
+	unsigned int flags, bad;
+
+	for (i = lane; i < N - F; i += warpSize) text_buf[i] = ' ';
+	__syncwarp();
+	while (pos < size) {
+		flags = in[pos++];
+		/* item lane of the group: a literal (from < 0) of byte lit or a pair
+		   of len bytes from ring position from */
+		at = pos + 2 * lane - __popc(flags & ((1u << (lane & 7)) - 1));
+		len = 0;  from = -1;  t = 0;
+		if (lane < 8) {
+			if ((flags >> lane) & 1) {
+				t = at < size;
+				if (t) lit = in[at];
+				len = 1;
+			} else {
+				t = at + 1 < size;
+				if (t) {
+					i = in[at];  j = in[at + 1];
+					from = i | ((j & 0xf0) << 4);
+					len = (j & 0x0f) + THRESHOLD + 1;
+				}
+			}
+		}
+		end = len;  /* inclusive scan: where item lane's bytes end */
+		for (d = 1; d < 8; d <<= 1) {
+			k = __shfl_up_sync(0xffffffff, end, d);
+			if (lane >= d) end += k;
+		}
+		/* Decode() stops at the first item past the code or the limit */
+		bad = __ballot_sync(0xffffffff, lane < 8 && (!t || n + end > limit));
+		items = bad ? __ffs(bad) - 1 : 8;
+		for (t = 0; t < items; t++) {
+			k = __shfl_sync(0xffffffff, len, t);
+			to = (r + __shfl_sync(0xffffffff, end, t) - k) & (N - 1);
+			i = __shfl_sync(0xffffffff, from, t);
+			j = __shfl_sync(0xffffffff, lit, t);
+			if (i < 0) {
+				if (lane == 0) text_buf[to] = j;
+			} else {
+				/* a pair reaching back d < k bytes repeats itself, so it
+				   goes d bytes at a time */
+				d = (to - i) & (N - 1);
+				if (d == 0 || d > k) d = k;
+				for (j = 0; j < k; j += d) {
+					if (lane < d && j + lane < k) b = text_buf[(i + j + lane) & (N - 1)];
+					__syncwarp();
+					if (lane < d && j + lane < k) text_buf[(to + j + lane) & (N - 1)] = b;
+					__syncwarp();
+				}
+			}
+			__syncwarp();
+		}
+		total = items ? __shfl_sync(0xffffffff, end, items - 1) : 0;
+		for (i = lane; i < total; i += warpSize) out[n + i] = text_buf[(r + i) & (N - 1)];
+		n += total;  r = (r + total) & (N - 1);
+		pos += 2 * items - __popc(flags & ((1u << items) - 1));
+		__syncwarp();
+		if (items < 8) break;
 	}
+	if (lane == 0) lengths[part] = n;
+}
+
+// Device buffers come from a cache per device, and pinned host buffers from
+// one cache for all of them (pool.h). Each size is allocated once per
+// process; later batches, segments and calls take back what the last gave.
+BufferCache ** device_caches = NULL, * pinned_cache = NULL;
+int cached_devices = 0;
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void * deviceAlloc(size_t size){
+    void * buf;
+    return cudaMalloc(&buf, size) == cudaSuccess ? buf : NULL;
+}
+
+void deviceRelease(void * buf){
+    checkCuda(cudaFree(buf));
+}
+
+void * pinnedAlloc(size_t size){
+    void * buf;
+    return cudaHostAlloc(&buf, size, cudaHostAllocPortable) == cudaSuccess ? buf : NULL;
+}
+
+void pinnedRelease(void * buf){
+    checkCuda(cudaFreeHost(buf));
+}
+
+// the cache of the current device, made on first use
+BufferCache * deviceCache(void){
+    BufferCache * cache;
+    int dev;
+    checkCuda(cudaGetDevice(&dev));
+    pthread_mutex_lock(&cache_lock);
+    if (device_caches == NULL) {
+        checkCuda(cudaGetDeviceCount(&cached_devices));
+        device_caches = (BufferCache **) calloc(cached_devices + 1, sizeof(BufferCache *));
+        checkAllocRAM(device_caches);
+    }
+    if (device_caches[dev] == NULL) device_caches[dev] = cacheCreate(deviceAlloc, deviceRelease);
+    cache = device_caches[dev];
+    pthread_mutex_unlock(&cache_lock);
+    checkAllocRAM(cache);
+    return cache;
+}
+
+// size bytes on the current device, given back with deviceGive() while
+// the same device is current
+template <typename T>
+void deviceTake(T ** buf, size_t size){
+    *buf = (T *) cacheTake(deviceCache(), size);
+    if (*buf == NULL) checkCuda(cudaErrorMemoryAllocation);
+}
+
+void deviceGive(void * buf){
+    cacheGive(deviceCache(), buf);
+}
+
+template <typename T>
+void pinnedTake(T ** buf, size_t size){
+    pthread_mutex_lock(&cache_lock);
+    if (pinned_cache == NULL) pinned_cache = cacheCreate(pinnedAlloc, pinnedRelease);
+    pthread_mutex_unlock(&cache_lock);
+    checkAllocRAM(pinned_cache);
+    *buf = (T *) cacheTake(pinned_cache, size);
+    if (*buf == NULL) checkCuda(cudaErrorMemoryAllocation);
+}
+
+void pinnedGive(void * buf){
+    cacheGive(pinned_cache, buf);
+}
+
+// every cached buffer back to the driver, once nothing is running
+void freeCaches(void){
+    int dev;
+    for (dev = 0; device_caches != NULL && dev < cached_devices; dev++)
+        if (device_caches[dev] != NULL) {
+            checkCuda(cudaSetDevice(dev));
+            cacheFree(device_caches[dev]);
+        }
+    free(device_caches);
+    cacheFree(pinned_cache);
+    device_caches = NULL;  pinned_cache = NULL;
+}
+
+// records the end of stage (0 when the uploads start, then 1 .. TIMED_STAGES)
+// on the default stream
+void markStage(int stage){
+    if (stage_mark[stage] == NULL) checkCuda(cudaEventCreate(&stage_mark[stage]));
+    checkCuda(cudaEventRecord(stage_mark[stage], 0));
+}
+
+// records the start of a launch of kernel name on stream, with --stats
+void kernelStart(const char * name, cudaStream_t stream){
+    if (!show_stats) return;
+    pthread_mutex_lock(&kernel_lock);
+    if (kernels_timed == kernel_room) {
+        kernel_room = kernel_room ? 2 * kernel_room : 16;
+        kernel_time = (KernelTime *) realloc(kernel_time, sizeof(KernelTime) * kernel_room);
+        checkAllocRAM(kernel_time);
+    }
+    KernelTime * k = &kernel_time[kernels_timed];
+    k->name = name;
+    checkCuda(cudaEventCreate(&k->start));
+    checkCuda(cudaEventCreate(&k->stop));
+    checkCuda(cudaEventRecord(k->start, stream));
+}
+
+// and its end, right after the launch
+void kernelStop(cudaStream_t stream){
+    if (!show_stats) return;
+    checkCuda(cudaEventRecord(kernel_time[kernels_timed++].stop, stream));
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+// --stats: launches and total time of each kernel, in the order first launched
+void printKernels(void){
+    int i, j, launches;
+    float ms, total;
+    for (i = 0; i < kernels_timed; i++) {
+        for (j = 0; j < i && strcmp(kernel_time[j].name, kernel_time[i].name) != 0; j++);
+        if (j < i) continue; // already counted with the first one of its name
+        for (launches = 0, total = 0, j = i; j < kernels_timed; j++) {
+            if (strcmp(kernel_time[j].name, kernel_time[i].name) != 0) continue;
+            checkCuda(cudaEventSynchronize(kernel_time[j].stop));
+            checkCuda(cudaEventElapsedTime(&ms, kernel_time[j].start, kernel_time[j].stop));
+            total += ms;
+            launches++;
+        }
+        printf("kernel %s: %d launches, %.3f ms\n", kernel_time[i].name, launches, total);
+    }
+    for (i = 0; i < kernels_timed; i++) {
+        checkCuda(cudaEventDestroy(kernel_time[i].start));
+        checkCuda(cudaEventDestroy(kernel_time[i].stop));
+    }
+    free(kernel_time);
+}
+
+// prints the time between the marks, one line that bench/bench.c looks for
+void printStages(void){
+    float ms[TIMED_STAGES];
+    int i;
+    if (stage_mark[TIMED_STAGES] == NULL) return;
+    checkCuda(cudaEventSynchronize(stage_mark[TIMED_STAGES]));
+    for (i = 0; i < TIMED_STAGES; i++)
+        checkCuda(cudaEventElapsedTime(&ms[i], stage_mark[i], stage_mark[i + 1]));
+    printf("gpu: upload %.3f ms, kernel %.3f ms, download %.3f ms\n", ms[0], ms[1], ms[2]);
+}
+
+// packs the code of the chunks (chunk i at out_cuda + out_stride * i,
+// sizes_cuda[i] bytes) into one run on the device, on stream
+void packCode(int chunks, int out_stride, const char * out_cuda, const int * sizes_cuda,
+        unsigned long long * starts_cuda, unsigned char * packed_cuda, cudaStream_t stream){
+    kernelStart("ScanSizes", stream);
+    ScanSizes << < 1, SCAN_THREADS, 0, stream >>>(chunks, sizes_cuda, starts_cuda);
+    kernelStop(stream);
+    if (chunks > 0) {
+        kernelStart("CompactCode", stream);
+        CompactCode << < chunks, COMPACT_THREADS, 0, stream >>>(out_stride, out_cuda,
+                sizes_cuda, starts_cuda, packed_cuda);
+        kernelStop(stream);
+    }
+    checkCuda(cudaGetLastError());
+}
+
+// only the packed code and the chunk starts (chunks + 1 of them) come back
+// to the host, and the counts of each chunk's code (256 per chunk) if freq
+// isn't NULL; returns the code, malloc'ed
+unsigned char * downloadCode(int chunks, int out_stride, const char * out_cuda,
+        const int * sizes_cuda, unsigned long long * starts, unsigned int * freq){
+    unsigned long long * starts_cuda;
+    unsigned char * packed_cuda, * code;
+    deviceTake(&starts_cuda, sizeof(unsigned long long) * (chunks + 1));
+    deviceTake(&packed_cuda, (size_t) out_stride * chunks + 1);
+    packCode(chunks, out_stride, out_cuda, sizes_cuda, starts_cuda, packed_cuda, 0);
+    unsigned int * freq_cuda = NULL;
+    if (freq != NULL && chunks > 0) {
+        deviceTake(&freq_cuda, sizeof(unsigned int) * 256 * chunks);
+        kernelStart("HistogramCUDA", 0);
+        HistogramCUDA << < chunks, HIST_THREADS >>>(packed_cuda, starts_cuda, freq_cuda);
+        kernelStop(0);
+        checkCuda(cudaGetLastError());
+    }
+    markStage(2);
+    if (freq_cuda != NULL) {
+        checkCuda(cudaMemcpy(freq, freq_cuda, sizeof(unsigned int) * 256 * chunks,
+                cudaMemcpyDeviceToHost));
+        deviceGive(freq_cuda);
+    }
+    checkCuda(cudaMemcpy(starts, starts_cuda, sizeof(unsigned long long) * (chunks + 1),
+            cudaMemcpyDeviceToHost));
+    code = (unsigned char *) malloc(starts[chunks] + 1);
+    checkAllocRAM(code);
+    checkCuda(cudaMemcpy(code, packed_cuda, starts[chunks], cudaMemcpyDeviceToHost));
+    markStage(3);
+    deviceGive(starts_cuda);
+    deviceGive(packed_cuda);
+    return code;
 }
 
 //cpu
-void writeFile(FILE * out, int part, int sizes[], char * str_out, int offset){
-	int i = 0;
-	while(i < sizes[part]){
-		putc(str_out[offset + i++], out);
-	}
-	putc(EOF, out);
+// chunk i of chunks takes its code from code[starts[i] .. starts[i + 1]) and
+// its input from str_in + chunk_size * i; the last one gets what is left.
+// With freq (the device's counts of each chunk's code) the code goes through
+// the Huffman stage first.
+int writeContainer(FILE * out, int chunks, int size, int chunk_size,
+        const unsigned char * str_in, const unsigned char * code, const unsigned long long starts[],
+        const unsigned int * freq){
+    Container c;
+    unsigned char * coded = NULL;
+    unsigned long long counts[256];
+    int i, j;
+    if (containerCreate(&c, out, chunks) != 0) return -1;
+    if (freq != NULL) {
+        unsigned long long longest = 0;
+        for (i = 0; i < chunks; i++)
+            if (starts[i + 1] - starts[i] > longest) longest = starts[i + 1] - starts[i];
+        coded = (unsigned char *) malloc(HUFF_BOUND(longest));
+        checkAllocRAM(coded);
+        c.flags = CONTAINER_HUFFMAN;
+    }
+    for (i = 0; i < chunks; i++) {
+        int len = i == chunks - 1 ? size - chunk_size * i : chunk_size;
+        const unsigned char * chunk = code + starts[i];
+        int csize = (int) (starts[i + 1] - starts[i]);
+        if (freq != NULL) {
+            for (j = 0; j < 256; j++) counts[j] = freq[256 * i + j];
+            csize = huffEncodeCounted(chunk, csize, counts, coded);
+            chunk = coded;
+        }
+        if (containerWriteChunk(&c, i, chunk, csize, len,
+                checksum(0, str_in + (size_t) chunk_size * i, len)) != 0) return -1;
+    }
+    free(coded);
+    return containerFinish(&c);
+}
+
+// stream mode: the input goes through the device one segment at a time, so
+// it may be larger than device memory.  Each slot has its own stream and
+// its own pinned and device buffers; while segment i uploads and encodes,
+// segment i - 1 downloads its code, packed on the device, and segment i - 2
+// is checksummed and written on the host.
+typedef struct {
+    cudaStream_t stream;
+    cudaEvent_t sized;       // the segment's starts have reached the host
+    unsigned char * in;      // pinned copy of the segment
+    unsigned char * out;     // pinned packed code of the segment
+    unsigned long long * starts;  // pinned, where each chunk's code starts in out
+    char * in_cuda;
+    char * out_cuda;
+    int * sizes_cuda;
+    unsigned long long * starts_cuda;
+    unsigned char * packed_cuda;
+    CompactTree * trees_cuda;
+    size_t start;            // of the segment in the input
+    int len, first, chunks;  // bytes, first chunk and number of chunks
+} StreamSlot;
+
+int encodeStreamed(FILE * out, const unsigned char * str_in, size_t size){
+    StreamSlot slots[STREAM_SLOTS];
+    Container c;
+    int chunk_size = gridChunkSize(size < STREAM_SEGMENT ? (int) size : STREAM_SEGMENT,
+            GRID_BLOCKS_PER_SM * GRID_THREADS);
+    int out_stride = CODED_BOUND(chunk_size);
+    int seg_chunks = (STREAM_SEGMENT + chunk_size - 1) / chunk_size;
+    size_t seg_size = (size_t) seg_chunks * chunk_size;
+    int total = (int) ((size + chunk_size - 1) / chunk_size);
+    int segments = (int) ((size + seg_size - 1) / seg_size);
+    int i, j, seg;
+
+    if (seg_size > size) {  // a small input needs no more than one segment
+        seg_chunks = total > 0 ? total : 1;
+        seg_size = (size_t) seg_chunks * chunk_size;
+    }
+    printf("%zu bytes in %d chunks of %d, %d segments\n", size, total, chunk_size, segments);
+
+    for (i = 0; i < STREAM_SLOTS; i++) {
+        StreamSlot * t = &slots[i];
+        checkCuda(cudaStreamCreate(&t->stream));
+        checkCuda(cudaEventCreate(&t->sized));
+        pinnedTake(&t->in, seg_size);
+        pinnedTake(&t->out, (size_t) out_stride * seg_chunks);
+        pinnedTake(&t->starts, sizeof(unsigned long long) * (seg_chunks + 1));
+        deviceTake(&t->in_cuda, seg_size);
+        deviceTake(&t->out_cuda, (size_t) out_stride * seg_chunks);
+        deviceTake(&t->sizes_cuda, sizeof(int) * seg_chunks);
+        deviceTake(&t->starts_cuda, sizeof(unsigned long long) * (seg_chunks + 1));
+        deviceTake(&t->packed_cuda, (size_t) out_stride * seg_chunks);
+        deviceTake(&t->trees_cuda, sizeof(CompactTree) * seg_chunks);
+    }
+    if (containerCreate(&c, out, total) != 0) return -1;
+
+    for (seg = 0; seg < segments + 2; seg++) {
+        if (seg < segments) {  // upload and encode segment seg
+            StreamSlot * t = &slots[seg % STREAM_SLOTS];
+            t->start = seg_size * seg;
+            t->len = (int) (size - t->start < seg_size ? size - t->start : seg_size);
+            t->first = seg_chunks * seg;
+            t->chunks = (t->len + chunk_size - 1) / chunk_size;
+            memcpy(t->in, str_in + t->start, t->len);  // reads the input file
+            checkCuda(cudaMemcpyAsync(t->in_cuda, t->in, t->len, cudaMemcpyHostToDevice, t->stream));
+            int threads = t->chunks < GRID_THREADS ? t->chunks : GRID_THREADS;
+            int blocks = (t->chunks + threads - 1) / threads;
+            kernelStart("EncodeCUDAGrid", t->stream);
+            EncodeCUDAGrid << < blocks, threads, 0, t->stream >>>(t->len, chunk_size, t->chunks,
+                    out_stride, t->in_cuda, t->out_cuda, t->sizes_cuda, t->trees_cuda);
+            kernelStop(t->stream);
+            checkCuda(cudaGetLastError());
+            packCode(t->chunks, out_stride, t->out_cuda, t->sizes_cuda, t->starts_cuda,
+                    t->packed_cuda, t->stream);
+            checkCuda(cudaMemcpyAsync(t->starts, t->starts_cuda,
+                    sizeof(unsigned long long) * (t->chunks + 1), cudaMemcpyDeviceToHost, t->stream));
+            checkCuda(cudaEventRecord(t->sized, t->stream));
+        }
+        if (seg >= 1 && seg - 1 < segments) {  // download the code of segment seg - 1
+            StreamSlot * t = &slots[(seg - 1) % STREAM_SLOTS];
+            checkCuda(cudaEventSynchronize(t->sized));
+            checkCuda(cudaMemcpyAsync(t->out, t->packed_cuda, t->starts[t->chunks],
+                    cudaMemcpyDeviceToHost, t->stream));
+        }
+        if (seg >= 2) {  // write segment seg - 2
+            StreamSlot * t = &slots[(seg - 2) % STREAM_SLOTS];
+            checkCuda(cudaStreamSynchronize(t->stream));
+            for (j = 0; j < t->chunks; j++) {
+                int len = t->len - chunk_size * j < chunk_size ? t->len - chunk_size * j : chunk_size;
+                const unsigned char * text = str_in + t->start + (size_t) chunk_size * j;
+                if (containerWriteChunk(&c, t->first + j, t->out + t->starts[j],
+                        t->starts[j + 1] - t->starts[j], len, checksum(0, text, len)) != 0) return -1;
+            }
+        }
+    }
+
+    for (i = 0; i < STREAM_SLOTS; i++) {
+        StreamSlot * t = &slots[i];
+        checkCuda(cudaStreamDestroy(t->stream));
+        checkCuda(cudaEventDestroy(t->sized));
+        pinnedGive(t->in);
+        pinnedGive(t->out);
+        pinnedGive(t->starts);
+        deviceGive(t->in_cuda);
+        deviceGive(t->out_cuda);
+        deviceGive(t->sizes_cuda);
+        deviceGive(t->starts_cuda);
+        deviceGive(t->packed_cuda);
+        deviceGive(t->trees_cuda);
+    }
+    return containerFinish(&c);
+}
+
+// monotonic clock, for the rates of the b and m modes
+double seconds(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// b and m modes: every device (and in b the cores) takes chunks from one
+// queue, and all of them write to one container, whose table keeps the
+// chunks in input order whoever coded them.  A core takes one chunk at a
+// time; a device takes a batch of them, sized from the rates seen so far
+// (see hybridBatch), on a host thread of its own.
+typedef struct {
+    Container * c;
+    const unsigned char * in;
+    int size, chunks;
+    int next;                      // first chunk nobody has taken yet
+    int devices;                   // pool tasks 0 .. devices - 1 drive one each
+    int cpu_threads;               // workers on the cores, 0 in m mode
+    FlzssEncoder ** encoder;       // of each pool worker
+    unsigned char ** out;          // code buffer of each pool worker
+    double cpu_bytes, cpu_busy;    // coded on the cores, and the seconds it took them
+    double gpu_bytes, gpu_busy;    // the same for the devices
+    int cpu_chunks, gpu_chunks, gpu_batches;
+    long long codesize;
+    int failed;
+    pthread_mutex_t lock;          // the queue, the counts and the container
+} HybridJob;
+
+// chunks a device takes next, 0 once it should leave the rest to the
+// others; called with the lock held, last being how long its own last batch
+// took (0 before the first).  Without cores the devices share what is left
+// evenly.  Otherwise, until both sides have a rate, a device takes its part
+// of a quarter of the input; then half the share of what is left that would
+// keep everybody busy until the end, so it measures again before the end,
+// and nothing once the cores would finish the rest before a batch of its
+// could come back.
+int hybridBatch(HybridJob * job, int most, double last){
+    int left = job->chunks - job->next, n;
+    if (left <= 0) return 0;
+    if (job->cpu_threads == 0) n = (left + job->devices - 1) / job->devices;
+    else if (job->gpu_batches == 0 || job->cpu_busy == 0) n = job->chunks / 4 / job->devices;
+    else {
+        double gpu = job->gpu_bytes / job->gpu_busy;  // of one device
+        double cpu = job->cpu_bytes / job->cpu_busy * job->cpu_threads;
+        if ((double) left * HYBRID_CHUNK / cpu < last) return 0;
+        n = (int) (left * gpu / (gpu * job->devices + cpu) / 2);
+    }
+    if (n > most) n = most;
+    if (n > left) n = left;
+    return n;
+}
+
+// the side of device dev, on its own stream and buffers: upload a batch,
+// encode it on a grid (a thread per chunk), bring back only the packed code
+// and write it
+void hybridDevice(HybridJob * job, int dev){
+    int chunk_size = HYBRID_CHUNK, out_stride = CODED_BOUND(chunk_size);
+    int most = HYBRID_BATCH / chunk_size, first, n, i;
+    double last = 0;
+    cudaStream_t stream;
+    char * in_cuda, * out_cuda;
+    int * sizes_cuda;
+    unsigned long long * starts_cuda, * starts;
+    unsigned char * packed_cuda, * code;
+    unsigned int * crcs;
+    CompactTree * trees_cuda;
+
+    if (job->cpu_threads > 0 && job->chunks < 4 * job->devices) return;  // hardly worth a launch
+    checkCuda(cudaSetDevice(dev));
+    checkCuda(cudaStreamCreate(&stream));
+    deviceTake(&in_cuda, (size_t) chunk_size * most);
+    deviceTake(&out_cuda, (size_t) out_stride * most);
+    deviceTake(&sizes_cuda, sizeof(int) * most);
+    deviceTake(&starts_cuda, sizeof(unsigned long long) * (most + 1));
+    deviceTake(&packed_cuda, (size_t) out_stride * most);
+    deviceTake(&trees_cuda, sizeof(CompactTree) * most);
+    pinnedTake(&starts, sizeof(unsigned long long) * (most + 1));
+    pinnedTake(&code, (size_t) out_stride * most);
+    crcs = (unsigned int *) malloc(sizeof(unsigned int) * most);
+    checkAllocRAM(crcs);
+
+    for ( ; ; ) {
+        pthread_mutex_lock(&job->lock);
+        n = hybridBatch(job, most, last);
+        first = job->next;
+        job->next += n;
+        pthread_mutex_unlock(&job->lock);
+        if (n == 0) break;
+
+        double t = seconds();
+        size_t start = (size_t) chunk_size * first;
+        int len = (int) (job->size - start < (size_t) chunk_size * n ? job->size - start
+                : (size_t) chunk_size * n);
+        checkCuda(cudaMemcpyAsync(in_cuda, job->in + start, len, cudaMemcpyHostToDevice, stream));
+        int threads = n < GRID_THREADS ? n : GRID_THREADS;
+        kernelStart("EncodeCUDAGrid", stream);
+        EncodeCUDAGrid << < (n + threads - 1) / threads, threads, 0, stream >>>(len, chunk_size, n,
+                out_stride, in_cuda, out_cuda, sizes_cuda, trees_cuda);
+        kernelStop(stream);
+        checkCuda(cudaGetLastError());
+        packCode(n, out_stride, out_cuda, sizes_cuda, starts_cuda, packed_cuda, stream);
+        checkCuda(cudaMemcpyAsync(starts, starts_cuda, sizeof(unsigned long long) * (n + 1),
+                cudaMemcpyDeviceToHost, stream));
+        checkCuda(cudaStreamSynchronize(stream));
+        checkCuda(cudaMemcpyAsync(code, packed_cuda, starts[n], cudaMemcpyDeviceToHost, stream));
+        checkCuda(cudaStreamSynchronize(stream));
+        for (i = 0; i < n; i++) {
+            int clen = len - chunk_size * i < chunk_size ? len - chunk_size * i : chunk_size;
+            crcs[i] = checksum(0, job->in + start + (size_t) chunk_size * i, clen);
+        }
+        last = t = seconds() - t;
+
+        pthread_mutex_lock(&job->lock);
+        for (i = 0; i < n; i++) {
+            int clen = len - chunk_size * i < chunk_size ? len - chunk_size * i : chunk_size;
+            if (containerWriteChunk(job->c, first + i, code + starts[i],
+                    (unsigned int) (starts[i + 1] - starts[i]), clen, crcs[i]) != 0)
+                job->failed = 1;
+        }
+        job->codesize += starts[n];
+        job->gpu_busy += t;
+        job->gpu_bytes += len;
+        job->gpu_chunks += n;
+        job->gpu_batches++;
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    checkCuda(cudaStreamDestroy(stream));
+    deviceGive(in_cuda);
+    deviceGive(out_cuda);
+    deviceGive(sizes_cuda);
+    deviceGive(starts_cuda);
+    deviceGive(packed_cuda);
+    deviceGive(trees_cuda);
+    pinnedGive(starts);
+    pinnedGive(code);
+    free(crcs);
+}
+
+// the first tasks drive a device each, every other one is a worker on the cores
+void hybridTask(void * arg, int index, int worker){
+    HybridJob * job = (HybridJob *) arg;
+    int part;
+
+    if (index < job->devices) {
+        hybridDevice(job, index);
+        return;
+    }
+    for ( ; ; ) {
+        pthread_mutex_lock(&job->lock);
+        part = job->next < job->chunks ? job->next++ : -1;
+        pthread_mutex_unlock(&job->lock);
+        if (part < 0) break;
+
+        double t = seconds();
+        size_t start = (size_t) HYBRID_CHUNK * part;
+        int len = job->size - start < HYBRID_CHUNK ? (int) (job->size - start) : HYBRID_CHUNK;
+        int codesize = flzssCompressChunk(job->encoder[worker], job->in + start, len,
+                job->out[worker]);
+        unsigned int crc = checksum(0, job->in + start, len);
+        t = seconds() - t;
+
+        pthread_mutex_lock(&job->lock);
+        if (codesize < 0 || containerWriteChunk(job->c, part, job->out[worker], codesize,
+                len, crc) != 0)
+            job->failed = 1;
+        job->codesize += codesize;
+        job->cpu_busy += t;
+        job->cpu_bytes += len;
+        job->cpu_chunks++;
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+// cores says whether the cores code chunks too (b) or only the devices (m)
+int encodeHybrid(FILE * out, const unsigned char * str_in, int size, int cores){
+    HybridJob job;
+    Container c;
+    int i, threads;
+
+    memset(&job, 0, sizeof(job));
+    job.c = &c;
+    job.in = str_in;
+    job.size = size;
+    job.chunks = (size + HYBRID_CHUNK - 1) / HYBRID_CHUNK;
+    checkCuda(cudaGetDeviceCount(&job.devices));
+    if (job.devices < 1) return -1;
+    if (cores) {  // one core drives each device
+        job.cpu_threads = poolCores() - job.devices;
+        if (job.cpu_threads < 1) job.cpu_threads = 1;
+    }
+    threads = job.devices + job.cpu_threads;
+    printf("%d bytes in %d chunks of %d, %d cores and %d devices\n", size, job.chunks,
+            HYBRID_CHUNK, job.cpu_threads, job.devices);
+
+    job.encoder = (FlzssEncoder **) calloc(threads, sizeof(FlzssEncoder *));
+    job.out = (unsigned char **) calloc(threads, sizeof(unsigned char *));
+    checkAllocRAM(job.encoder);
+    checkAllocRAM(job.out);
+    for (i = 0; i < threads; i++) {
+        job.encoder[i] = flzssEncoderCreate(CONTAINER_FORMAT_4K, 0);
+        job.out[i] = (unsigned char *) malloc(FLZSS_BOUND(HYBRID_CHUNK));
+        checkAllocRAM(job.encoder[i]);
+        checkAllocRAM(job.out[i]);
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    if (containerCreate(&c, out, job.chunks) != 0) return -1;
+    if (poolRun(threads, threads, hybridTask, &job) != 0 || job.failed) return -1;
+    pthread_mutex_destroy(&job.lock);
+
+    printf("cores: %d chunks, %.1f MB/s each\n", job.cpu_chunks,
+            job.cpu_busy > 0 ? job.cpu_bytes / job.cpu_busy / 1e6 : 0.0);
+    printf("devices: %d chunks in %d batches, %.1f MB/s each\n", job.gpu_chunks, job.gpu_batches,
+            job.gpu_busy > 0 ? job.gpu_bytes / job.gpu_busy / 1e6 : 0.0);
+    printf("Out: %lld bytes\n", job.codesize);
+    for (i = 0; i < threads; i++) {
+        flzssEncoderFree(job.encoder[i]);
+        free(job.out[i]);
+    }
+    free(job.encoder);
+    free(job.out);
+    return containerFinish(&c);
+}
+
+// Decodes every chunk of c into text_cuda, which must hold c->size bytes of
+// device memory, a warp per chunk: the text is left on the device, for code
+// there to use without a round trip through the host.  lengths[i] gets the
+// bytes chunk i decoded to.  Returns 0 if every length is right, otherwise
+// -1 with *bad set to the first chunk that couldn't be read or was the wrong
+// length (c->chunks if the table is inconsistent).  The checksums need the
+// text on the host, so they are left to the caller.
+int decodeDevice(Container * c, unsigned char * text_cuda, int * lengths, unsigned int * bad){
+    unsigned long long * code_start = (unsigned long long *) malloc(sizeof(unsigned long long) * (c->chunks + 1));
+    unsigned long long * text_start = (unsigned long long *) malloc(sizeof(unsigned long long) * (c->chunks + 1));
+    unsigned int part;
+    checkAllocRAM(code_start);
+    checkAllocRAM(text_start);
+    *bad = c->chunks;
+    code_start[0] = text_start[0] = 0;
+    for (part = 0; part < c->chunks; part++) {
+        code_start[part + 1] = code_start[part] + c->table[part].csize;
+        text_start[part + 1] = text_start[part] + c->table[part].usize;
+    }
+    if (text_start[c->chunks] != c->size) return -1;
+
+    // all the code, packed in part order
+    unsigned char * code = (unsigned char *) malloc(code_start[c->chunks] + 1);
+    checkAllocRAM(code);
+    for (part = 0; part < c->chunks; part++) {
+        if (containerReadChunk(c, part, code + code_start[part]) != 0) {
+            *bad = part;
+            return -1;
+        }
+    }
+
+    unsigned char * code_cuda;
+    unsigned long long * code_start_cuda;
+    unsigned long long * text_start_cuda;
+    int * lengths_cuda;
+
+    deviceTake(&code_cuda, code_start[c->chunks] + 1);
+    deviceTake(&code_start_cuda, sizeof(unsigned long long) * (c->chunks + 1));
+    deviceTake(&text_start_cuda, sizeof(unsigned long long) * (c->chunks + 1));
+    deviceTake(&lengths_cuda, sizeof(int) * c->chunks + 1);
+
+    markStage(0);
+    checkCuda(cudaMemcpy(code_cuda, code, code_start[c->chunks], cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(code_start_cuda, code_start, sizeof(unsigned long long) * (c->chunks + 1), cudaMemcpyHostToDevice));
+    checkCuda(cudaMemcpy(text_start_cuda, text_start, sizeof(unsigned long long) * (c->chunks + 1), cudaMemcpyHostToDevice));
+    markStage(1);
+
+    if (c->chunks > 0) {  // s writes no chunks for an empty file
+        int blocks = (c->chunks + WARP_CHUNKS_PER_BLOCK - 1) / WARP_CHUNKS_PER_BLOCK;
+        kernelStart("DecodeCUDAWarp", 0);
+        DecodeCUDAWarp << < blocks, WARP_CHUNKS_PER_BLOCK * 32 >>>(c->chunks, code_cuda,
+                code_start_cuda, text_cuda, text_start_cuda, lengths_cuda);
+        kernelStop(0);
+        checkCuda(cudaGetLastError());
+    }
+    markStage(2);
+    checkCuda(cudaMemcpy(lengths, lengths_cuda, sizeof(int) * c->chunks, cudaMemcpyDeviceToHost));
+
+    deviceGive(code_cuda);
+    deviceGive(code_start_cuda);
+    deviceGive(text_start_cuda);
+    deviceGive(lengths_cuda);
+    free(code);
+    free(code_start);
+    free(text_start);
+    for (part = 0; part < c->chunks; part++) {
+        if (lengths[part] != (int) c->table[part].usize) {
+            *bad = part;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// e, b, m, g and w hold every offset of the input in an int, on the device
+// too; s takes it a segment at a time and has no such limit
+int tooLarge(const MappedFile * input, const char * name){
+    if (input->size <= INT_MAX) return 0;
+    printf("??? %s is over %d bytes, s encodes it\n", name, INT_MAX);
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
     char *s, *in;
 
-    char * str_in; // TODO: can have in global memory since
-    char * str_out; // TODO: need to come up with better way
-    int sizes[PARTITIONS];
+    MappedFile input; // the input file, copied to the device straight from the mapping
+    const unsigned char * str_in;
+    unsigned char * str_out; // the code of every chunk, packed on the device
+    unsigned long long starts[PARTITIONS + 1];
+    unsigned int * freq = NULL; // counts of each chunk's code for --huffman
+    int i, j, huffman = 0;
 
+    for (i = j = 1; i < argc; i++) { // options go anywhere
+        if (strcmp(argv[i], "--huffman") == 0) huffman = 1;
+        else if (strcmp(argv[i], "--stats") == 0) show_stats = 1;
+        else argv[j++] = argv[i];
+    }
+    argv[argc = j] = NULL;
     if (argc != 4) {
         printf("'lzss e file1 file2' encodes file1 into file2.\n"
-                "'lzss d file2 file1' decodes file2 into file1.\n");
+                "'lzss g file1 file2' encodes file1 into file2 on a grid of\n"
+                "                     chunks sized from file1 and the device.\n"
+                "'lzss w file1 file2' same as g, but each chunk is searched\n"
+                "                     by a whole warp instead of a tree.\n"
+                "'lzss s file1 file2' same as g, but file1 goes through the device\n"
+                "                     in segments, copies overlapping the encode.\n"
+                "'lzss b file1 file2' encodes file1 into file2 on every device and\n"
+                "                     on the cores at once, split by their speed.\n"
+                "'lzss m file1 file2' same as b, but on every device and no cores.\n"
+                "'lzss d file2 file1' decodes file2 into file1, all parts at once\n"
+                "                     on the cores of the machine.\n"
+                "'lzss u file2 file1' same as d, but the parts are decoded on the device,\n"
+                "                     a warp each.\n"
+                "--huffman also Huffman codes the code of every chunk (e, g and w),\n"
+                "          counted on the device; lzsspa d decodes it.\n"
+                "--stats prints the time of every kernel (all but d), from CUDA events.\n");
         return EXIT_FAILURE;
     }
-    if ((s = argv[1], s[1] || strpbrk(s, "DEde") == NULL)
+    if ((s = argv[1], s[1] || strpbrk(s, "BDEGMSUWbdegmsuw") == NULL)
             || (s = argv[2], in = argv[2], (infile = fopen(s, "rb")) == NULL)
-            || (s = argv[3], (outfile = fopen(s, "wb")) == NULL)) {
+            || (s = argv[3], (outfile = fopen(s, "w+b")) == NULL)) {
         printf("??? %s\n", s);
         return EXIT_FAILURE;
     }
-    remove(s);
-    int i;
 
     if (toupper(*argv[1]) == 'E') {
         /*
@@ -298,13 +1280,14 @@ int main(int argc, char *argv[]) {
          */
 
         // file size
-        stat(argv[2], &st);
-        int size = st.st_size;	
-
-        str_in = (char *) malloc(size);
-        str_out = (char *) malloc(size);
-
-        readFile(infile, str_in);
+        if (mapInput(&input, infile) != 0) {
+            printf("??? %s\n", in);
+            return EXIT_FAILURE;
+        }
+        if (tooLarge(&input, in)) return EXIT_FAILURE;
+        str_in = input.data;
+        int size = (int) input.size;
+        int out_stride = CODED_BOUND(size/PARTITIONS + size%PARTITIONS);
 
         //cuda alloc
         char * str_in_cuda;
@@ -312,9 +1295,9 @@ int main(int argc, char *argv[]) {
         int * sizes_cuda;
 
         //allocate gpu mem
-        checkCuda(cudaMalloc((void**) &str_in_cuda, size));
-        checkCuda(cudaMalloc((void**) &str_out_cuda, size));
-        checkCuda(cudaMalloc((void**) &sizes_cuda, sizeof(int)*PARTITIONS));
+        deviceTake(&str_in_cuda, size);
+        deviceTake(&str_out_cuda, (size_t) out_stride * PARTITIONS);
+        deviceTake(&sizes_cuda, sizeof(int)*PARTITIONS);
         //int i;
         /*for (i = 0; i < PARTITIONS; i++) {
             
@@ -324,39 +1307,29 @@ int main(int argc, char *argv[]) {
 
         //copy to cuda mem
         //cudaMemcpy(str_in_cuda, str_in, size, cudaMemcpyHostToDevice);
+        markStage(0);
         checkCuda(cudaMemcpy(str_in_cuda, str_in, size, cudaMemcpyHostToDevice));
+        markStage(1);
 
         // kernel call - save all encoded files to array elements
         // run function on GPU <<<blocks, no_of_threads>>>
 
-        EncodeCUDA << < 1, PARTITIONS >>>(size, str_in_cuda, str_out_cuda, sizes_cuda);
-
-        // TODO: copy back to RAM from GPU
-        //cudaMemcpy(str_out, str_out_cuda, PARTITIONS * sizeof (char*), cudaMemcpyDeviceToHost);
-        checkCuda(cudaMemcpy(str_out, str_out_cuda, size, cudaMemcpyDeviceToHost));
-        //TODO: :cudaErrorInvalidValue Error Code : 11
+        kernelStart("EncodeCUDA", 0);
+        EncodeCUDA << < 1, PARTITIONS >>>(size, out_stride, str_in_cuda, str_out_cuda, sizes_cuda);
+        kernelStop(0);
 
-        /*for (i = 0; i < PARTITIONS; i++) {
-            //cudaMemcpy(str_out, str_out_cuda, (size / PARTITIONS + size % PARTITIONS) * sizeof (char), cudaMemcpyDeviceToHost);
-            checkCuda(cudaMemcpy(str_out, str_out_cuda, (size/PARTITIONS + size%PARTITIONS)*sizeof(char), cudaMemcpyDeviceToHost));
-        }*/
-        
-        cudaMemcpy(sizes, sizes_cuda, sizeof(int)*PARTITIONS, cudaMemcpyDeviceToHost);
-        //checkCuda(cudaMemcpy(sizes, sizes_cuda, sizeof(int)*PARTITIONS, cudaMemcpyDeviceToHost));
+        // copy back to RAM from GPU, just the code and where each part's starts
+        if (huffman) {
+            freq = (unsigned int *) malloc(sizeof(unsigned int) * 256 * PARTITIONS);
+            checkAllocRAM(freq);
+        }
+        str_out = downloadCode(PARTITIONS, out_stride, str_out_cuda, sizes_cuda, starts, freq);
 
         // file write
-        for (i = 0; i < PARTITIONS; i++) {
-            //printf("part %d - %d\n", i, sizes[i]);
-            char fileName[strlen(s)+5];
-            // creating file names
-            sprintf(fileName, "%s.%d", s, i);
-            //printf("%s\n", fileName);
-            FILE * out = fopen(fileName, "wb");
-            //s[strlen(s) - 2] = '\0';
-
-            // write encoded
-            int offset = (size/PARTITIONS) * i;
-            writeFile(out, i, sizes, str_out, offset);
+        if (writeContainer(outfile, PARTITIONS, size, size/PARTITIONS,
+                str_in, str_out, starts, freq) != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
         }
 
         /*
@@ -364,18 +1337,165 @@ int main(int argc, char *argv[]) {
         printf("\nEnd time: %ld\n", end);
         printf("\nTime taken: %f\n",difftime(end, start));
 		    */
+    } else if (toupper(*argv[1]) == 'S') {
+        if (mapInput(&input, infile) != 0) {
+            printf("??? %s\n", in);
+            return EXIT_FAILURE;
+        }
+        if (encodeStreamed(outfile, input.data, input.size) != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
+        }
+        unmapFile(&input);
+    } else if (toupper(*argv[1]) == 'B' || toupper(*argv[1]) == 'M') {
+        if (mapInput(&input, infile) != 0) {
+            printf("??? %s\n", in);
+            return EXIT_FAILURE;
+        }
+        if (tooLarge(&input, in)) return EXIT_FAILURE;
+        if (encodeHybrid(outfile, input.data, (int) input.size, toupper(*argv[1]) == 'B') != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
+        }
+        unmapFile(&input);
+    } else if (toupper(*argv[1]) == 'G' || toupper(*argv[1]) == 'W') {
+        int warp_mode = toupper(*argv[1]) == 'W';
+
+        if (mapInput(&input, infile) != 0) {
+            printf("??? %s\n", in);
+            return EXIT_FAILURE;
+        }
+        if (tooLarge(&input, in)) return EXIT_FAILURE;
+        str_in = input.data;
+        int size = (int) input.size;
+        int chunk_size = gridChunkSize(size, warp_mode ? WARP_CHUNKS_PER_SM
+                : GRID_BLOCKS_PER_SM * GRID_THREADS);
+        int chunks = (size + chunk_size - 1) / chunk_size;
+        int out_stride = CODED_BOUND(chunk_size);
+        printf("%d bytes in %d chunks of %d\n", size, chunks, chunk_size);
+
+        unsigned long long * chunk_starts = (unsigned long long *) malloc(sizeof(unsigned long long) * (chunks + 1));
+        checkAllocRAM(chunk_starts);
+
+        char * str_in_cuda;
+        char * str_out_cuda;
+        int * sizes_cuda;
+        CompactTree * trees_cuda = NULL;
+
+        deviceTake(&str_in_cuda, size);
+        deviceTake(&str_out_cuda, (size_t) out_stride * chunks);
+        deviceTake(&sizes_cuda, sizeof(int) * chunks);
+
+        markStage(0);
+        checkCuda(cudaMemcpy(str_in_cuda, str_in, size, cudaMemcpyHostToDevice));
+        markStage(1);
+
+        if (warp_mode) {
+            int blocks = (chunks + WARP_CHUNKS_PER_BLOCK - 1) / WARP_CHUNKS_PER_BLOCK;
+            kernelStart("EncodeCUDAWarp", 0);
+            EncodeCUDAWarp << < blocks, WARP_CHUNKS_PER_BLOCK * 32 >>>(size, chunk_size,
+                    chunks, out_stride, str_in_cuda, str_out_cuda, sizes_cuda);
+            kernelStop(0);
+        } else {
+            int threads = chunks < GRID_THREADS ? chunks : GRID_THREADS;
+            int blocks = (chunks + threads - 1) / threads;
+            deviceTake(&trees_cuda, sizeof(CompactTree) * chunks);
+            kernelStart("EncodeCUDAGrid", 0);
+            EncodeCUDAGrid << < blocks, threads >>>(size, chunk_size, chunks, out_stride,
+                    str_in_cuda, str_out_cuda, sizes_cuda, trees_cuda);
+            kernelStop(0);
+        }
+        checkCuda(cudaGetLastError());
+
+        if (huffman) {
+            freq = (unsigned int *) malloc(sizeof(unsigned int) * 256 * chunks + 1);
+            checkAllocRAM(freq);
+        }
+        str_out = downloadCode(chunks, out_stride, str_out_cuda, sizes_cuda, chunk_starts, freq);
+
+        if (writeContainer(outfile, chunks, size, chunk_size,
+                str_in, str_out, chunk_starts, freq) != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
+        }
+
+        deviceGive(str_in_cuda);
+        deviceGive(str_out_cuda);
+        deviceGive(sizes_cuda);
+        if (trees_cuda != NULL) deviceGive(trees_cuda);
+        unmapFile(&input);
+        free(str_out);
+        free(chunk_starts);
+        free(freq);
     } else {
-        // Decode
-        int part = 0;
-        for (part = 0; part < PARTITIONS; part++) {
-            in[strlen(in) - 2] = '\0';
-            sprintf(in, "%s.%d", in, part);
-            printf("%s\n", in);
-            FILE * inf = fopen(in, "rb");
-            Decode(inf);
-            fclose(inf);
+        // Decode - one container, whichever encoder wrote it; every part
+        // goes straight to its place in text
+        Container c;
+        unsigned int part, bad = 0;
+        if (containerOpen(&c, infile) != 0) {
+            printf("??? %s\n", in);
+            return EXIT_FAILURE;
+        }
+        if (c.flags != CONTAINER_FORMAT_4K) {
+            printf("??? %s: only lzsspa decodes this format\n", in);
+            return EXIT_FAILURE;
+        }
+        // a primed part (lzsspa a --prime) starts its window on the text
+        // before it, which neither decoder here has, and the device decoder
+        // takes every part for code, stored ones too (lzsspa e on input that
+        // won't shrink)
+        for (part = 0; part < c.chunks; part++)
+            if (c.table[part].flags != 0) {
+                printf("??? %s: only lzsspa decodes part %u\n", in, part);
+                return EXIT_FAILURE;
+            }
+        MappedFile output;
+        if (mapOutput(&output, outfile, c.size) != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
+        }
+        unsigned char * text = output.data;
+
+        if (toupper(*argv[1]) == 'D') {
+            if (containerDecodeAll(&c, text, 0, Decode, &bad) != 0) {
+                if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+                else printf("??? %s\n", in);
+                return EXIT_FAILURE;
+            }
+        } else {
+            unsigned char * text_cuda;
+            int * lengths = (int *) malloc(sizeof(int) * c.chunks + 1);
+            checkAllocRAM(lengths);
+            deviceTake(&text_cuda, c.size + 1);
+            if (decodeDevice(&c, text_cuda, lengths, &bad) != 0) {
+                if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+                else printf("??? %s\n", in);
+                return EXIT_FAILURE;
+            }
+            checkCuda(cudaMemcpy(text, text_cuda, c.size, cudaMemcpyDeviceToHost));
+            markStage(3);
+
+            unsigned long long start = 0;
+            for (part = 0; part < c.chunks; part++) {
+                if (lengths[part] != (int) c.table[part].usize
+                        || checksum(0, text + start, lengths[part]) != c.table[part].crc) {
+                    printf("??? %s: part %u is damaged\n", in, part);
+                    return EXIT_FAILURE;
+                }
+                start += lengths[part];
+            }
+            deviceGive(text_cuda);
+            free(lengths);
+        }
+        if (unmapFile(&output) != 0) {
+            printf("??? %s\n", s);
+            return EXIT_FAILURE;
         }
+        containerClose(&c);
     }
+    printStages(); // nothing for b, d, m and s, which time no stages
+    if (show_stats) printKernels();
+    freeCaches();
     fclose(infile);
     fclose(outfile);
     return EXIT_SUCCESS;
@@ -18,6 +18,10 @@
 #include <sys/wait.h>
 #include <unistd.h> 
 #include <time.h>
+#include <pthread.h>
+#include "container.h"
+#include "mapfile.h"
+#include "pool.h"
 
 #define N		 4096	/* size of ring buffer */
 #define F		   18	/* upper limit for match_length */
@@ -25,22 +29,15 @@
 						   if match_length is greater than this */
 #define NIL			N	/* index for root of binary search trees */
 
-#define PARTITIONS 8
+#define CHUNK_SIZE	(1024 * 1024)	/* bytes of input encoded by one task */
+#define CODED_BOUND(n)	((n) + (n) / 8 + 9)	/* worst case code size of
+						   n input bytes (all literals) */
 
 // TODO: need to remove coupling of all these variables
 
 
 FILE	*infile, *outfile;  /* input & output files */
 
-struct stat st; /* to get file size */
-void createStringOfSize(int size, char * str_in[], char ** str_out[]){
-	*str_in = (char *) malloc (size);
-	int i;
-	for(i=0; i<PARTITIONS; i++){
-		*str_out[i] = (char *) malloc (size/PARTITIONS + size%PARTITIONS);
-	}
-}
-
 // TODO: device
 void InitTree(int lson[], int rson[], int dad[])  /* initialize trees */
 {
@@ -118,7 +115,7 @@ void DeleteNode(int p, int lson[], int rson[], int dad[])  /* deletes node p fro
 }
 
 // TODO: global
-void Encode(int upper, int part, int offset, char * str_in, char * str_out[], int sizes[])  //txt buf
+int Encode(unsigned long upper, size_t offset, const unsigned char * str_in, char * str_out)  //txt buf
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
 	
@@ -137,8 +134,7 @@ void Encode(int upper, int part, int offset, char * str_in, char * str_out[], in
 	unsigned long int
 			textsize = 0,	/* text size counter */
 			textcount = 0,	/* second text size counter */
-			codesize = 0,	/* code size counter */
-			printcount = 0;	/* counter for reporting progress every 1K bytes */
+			codesize = 0;	/* code size counter */
 	
 	InitTree(lson, rson, dad);  /* initialize trees */
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
@@ -149,13 +145,10 @@ void Encode(int upper, int part, int offset, char * str_in, char * str_out[], in
 	s = 0;  r = N - F;
 	for (i = s; i < r; i++) text_buf[i] = ' ';  /* Clear the buffer with
 		any character that will appear often. */
-	for (len = 0; len < F && (c = str_in[textcount+offset]) != EOF && ++textcount <= upper; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
-			the buffer */
-	if ((textsize = len) == 0) {
-		sizes[part] = 0;
-		return;  /* text of size zero */
-	}
+	for (len = 0; len < F && textcount < upper; len++)
+		text_buf[r + len] = str_in[offset + textcount++];  /* Read F bytes
+			into the last F bytes of the buffer */
+	if ((textsize = len) == 0) return 0;  /* text of size zero */
 	for (i = 1; i <= F; i++) InsertNode(r - i, lson, rson, dad, &match_position, &match_length, text_buf);  /* Insert the F strings,
 		each of which begins with one or more 'space' characters.  Note
 		the order in which these strings are inserted.  This way,
@@ -178,13 +171,13 @@ void Encode(int upper, int part, int offset, char * str_in, char * str_out[], in
 		}
 		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
 			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				str_out[part][codesize+i] = code_buf[i];     /* code together */
+				str_out[codesize+i] = code_buf[i];     /* code together */
 			codesize += code_buf_ptr;
 			code_buf[0] = 0;  code_buf_ptr = mask = 1;
 		}
 		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = str_in[textcount+offset]) != EOF && ++textcount <= upper; i++) {
+		for (i = 0; i < last_match_length && textcount < upper; i++) {
+			c = str_in[offset + textcount++];  /* by count, so 0xff is just a byte */
 			DeleteNode(s, lson, rson, dad);		/* Delete old strings and */
 			text_buf[s] = c;	/* read new bytes */
 			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
@@ -195,11 +188,7 @@ void Encode(int upper, int part, int offset, char * str_in, char * str_out[], in
 				   modulo N. */
 			InsertNode(r, lson, rson, dad, &match_position, &match_length, text_buf);	/* Register the string in text_buf[r..r+F-1] */
 		}
-		if ((textsize += i) > printcount) {
-			/*printf("%12ld\r", textsize);*/  printcount += 1024;
-				/* Reports progress each time the textsize exceeds
-				   multiples of 1024. */
-		}
+		textsize += i;
 		while (i++ < last_match_length) {	/* After the end of text, */
 			DeleteNode(s, lson, rson, dad);					/* no need to read, but */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
@@ -207,20 +196,23 @@ void Encode(int upper, int part, int offset, char * str_in, char * str_out[], in
 		}
 	} while (len > 0);	/* until length of string to be processed is zero */
 	if (code_buf_ptr > 1) {		/* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++) str_out[part][codesize+i] = code_buf[i];
+		for (i = 0; i < code_buf_ptr; i++) str_out[codesize+i] = code_buf[i];
 		codesize += code_buf_ptr;
 	}
 	printf("In : %ld bytes\n", textsize);	/* Encoding is done. */
 	printf("Out: %ld bytes\n", codesize);
 	printf("Out/In: %.3f\n", (double)codesize / textsize);
-	sizes[part] = codesize;
+	return codesize;
 }
 
 // TODO: global
 // no branches
-void Decode(FILE * in)	/* Just the reverse of Encode(). */
+int Decode(const unsigned char *in, int size, unsigned char *out, int limit)
+	/* Just the reverse of Encode().  Decodes the size bytes of code at in
+	   into out, never writing more than limit bytes, and returns the
+	   number of bytes written. */
 {
-	int  i, j, k, r, c;
+	int  i, j, k, r, c, pos = 0, n = 0;
 	unsigned int  flags;
 	
 	unsigned char
@@ -231,46 +223,55 @@ void Decode(FILE * in)	/* Just the reverse of Encode(). */
 	r = N - F;  flags = 0;
 	for ( ; ; ) {
 		if (((flags >>= 1) & 256) == 0) {
-			if ((c = getc(in)) == EOF) break;
-			flags = c | 0xff00;		/* uses higher byte cleverly */
+			if (pos >= size) break;
+			flags = in[pos++] | 0xff00;		/* uses higher byte cleverly */
 		}							/* to count eight */
 		if (flags & 1) {
-			if ((c = getc(in)) == EOF) break;
-			putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+			if (pos >= size || n >= limit) break;
+			c = in[pos++];
+			out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 		} else {
-			if ((i = getc(in)) == EOF) break;
-			if ((j = getc(in)) == EOF) break;
+			if (pos + 1 >= size) break;
+			i = in[pos++];  j = in[pos++];
 			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
+			if (n + j >= limit) break;
 			for (k = 0; k <= j; k++) {
 				c = text_buf[(i + k) & (N - 1)];
-				putc(c, outfile);  text_buf[r++] = c;  r &= (N - 1);
+				out[n++] = c;  text_buf[r++] = c;  r &= (N - 1);
 			}
 		}
 	}
+	return n;
 }
 
-void readFile(FILE * in, char * str_in){
-	int i = 0;
-	while(1){
-		char c = getc(in);
-		str_in[i++] = c;
-		if(c == EOF) break;
-	}
-}
+/* the chunks of one encode, shared by the workers of the pool; the search
+   state lives on each worker's stack in Encode() */
+typedef struct {
+	Container *c;
+	const unsigned char *str_in;	/* the mapped input file */
+	size_t size;		/* of str_in, which may be more than an int holds */
+	char **out;		/* code buffer of each worker */
+	int failed;
+	pthread_mutex_t lock;	/* one worker writes to the container at a time */
+} EncodeJob;
 
-void writeFile(FILE * out, int part, int size, char * str_out[]){
-	int i = 0;
-	while(i < size){
-		putc(str_out[part][i++], out);
-	}
-	putc(EOF, out);
+void encodeTask(void *arg, int part, int worker)
+{
+	EncodeJob *job = (EncodeJob *) arg;
+	size_t offset = (size_t) CHUNK_SIZE * part;
+	int len = job->size - offset < CHUNK_SIZE ? (int) (job->size - offset) : CHUNK_SIZE;
+	int codesize = Encode(len, offset, job->str_in, job->out[worker]);
+	unsigned int crc = checksum(0, job->str_in + offset, len);
+
+	pthread_mutex_lock(&job->lock);		/* written as soon as it is done */
+	if (containerWriteChunk(job->c, part, job->out[worker], codesize, len, crc) != 0)
+		job->failed = 1;
+	pthread_mutex_unlock(&job->lock);
 }
 
 int main(int argc, char *argv[])
 {
 	char  *s, *in;	
-	char * str_in, // TODO: can have in global memory since
-		* str_out[PARTITIONS]; // TODO: need to come up with better way
 	
 	if (argc != 4) {
 		printf("'lzss e file1 file2' encodes file1 into file2.\n"
@@ -279,71 +280,65 @@ int main(int argc, char *argv[])
 	}
 	if ((s = argv[1], s[1] || strpbrk(s, "DEde") == NULL)
 	 || (s = argv[2], in = argv[2], (infile  = fopen(s, "rb")) == NULL)
-	 || (s = argv[3], (outfile = fopen(s, "wb")) == NULL)) {
+	 || (s = argv[3], (outfile = fopen(s, "w+b")) == NULL)) {
 		printf("??? %s\n", s);  return EXIT_FAILURE;
 	}
 	if (toupper(*argv[1]) == 'E'){
 		time_t start = time(NULL);
 		printf("\nStart time: %ld\n", start);
-		pid_t pids[PARTITIONS];
-		stat(argv[2], &st);
-		int size = st.st_size;
-		str_in = (char *) malloc (size);
-		int i;
-		for(i=0; i<PARTITIONS; i++){
-			str_out[i] = (char *) malloc (size/PARTITIONS + size%PARTITIONS);
-		}
-		//createStringOfSize(size, &str_in, &str_out);
-		printf("%d\n",size);
-		int part = 0, seeksize = size/PARTITIONS, sizes[PARTITIONS];
-		remove(s);
-		readFile(infile, str_in);
-		// TODO: move all to device memory;
-		// TODO: kernel call
-		// TODO: save all encoded files to array elements
-		// TODO: move that to main memory
-		// TODO: file write
-		for(part = 0; part < PARTITIONS; part++){
-			int pid =fork();
-			if(pid > 0) {
-				pids[part] = pid;
-				continue;
-			} else {
-				//chdir(path);
-				//FILE * infile_part = fopen(in, "rb");
-				//fseek(infile_part, seeksize*part, SEEK_SET);
-				//printf("%.2f%%\n",part/(float)PARTITIONS);
-				//printf("\n\nPart: %d\n\n", part);
-				sprintf(s,"%s.%d",s,part);
-				FILE * out = fopen(s, "wb");
-				s[strlen(s)-2] = '\0';
-				//nice(-15);
-				Encode(seeksize+(part==PARTITIONS ? size%PARTITIONS:0), part, size/PARTITIONS * part, str_in, str_out, sizes);
-				writeFile(out, part, sizes[part], str_out);
-				return EXIT_SUCCESS;
-			}
+		MappedFile input;
+		if (mapInput(&input, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
 		}
-		for(part = 0; part < PARTITIONS; part++) {
-			if(pids[part] > 0) {
-				printf("\n\nWaiting on part: %d\n\n", part);
-				waitpid(pids[part], NULL, 0);
-			}
+		size_t size = input.size;
+		printf("%llu\n", (unsigned long long) size);
+		/* fixed size chunks, taken by one worker thread per core */
+		int part, chunks = (int) ((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+		int threads = poolThreads(0, chunks);
+		Container c;
+		EncodeJob job;
+		job.c = &c;  job.str_in = input.data;  job.size = size;  job.failed = 0;
+		job.out = (char **) malloc (sizeof(char *) * threads);
+		for(part = 0; part < threads; part++)
+			job.out[part] = (char *) malloc (CODED_BOUND(CHUNK_SIZE));
+		pthread_mutex_init(&job.lock, NULL);
+		if (containerCreate(&c, outfile, chunks) != 0
+		 || poolRun(threads, chunks, encodeTask, &job) != 0 || job.failed
+		 || containerFinish(&c) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
 		}
+		pthread_mutex_destroy(&job.lock);
+		for(part = 0; part < threads; part++) free(job.out[part]);
+		free(job.out);
+		unmapFile(&input);
 		time_t end = time(NULL);// - start;
 		printf("\nEnd time: %ld\n", end);
 		printf("\nTime taken: %f\n",difftime(end, start));
 		//int msec = diff * 1000 / CLOCKS_PER_SEC;
 		//printf("Time taken %d seconds %d milliseconds\n", msec/1000, msec%1000);
 	} else {
-		int part = 0;
-		for(part = 0; part < PARTITIONS; part++){
-			in[strlen(in)-2] = '\0';
-			sprintf(in,"%s.%d",in,part);
-			printf("%s\n",in);
-			FILE * inf = fopen(in, "rb");
-			Decode(inf);
-			fclose(inf);
+		/* every part is decoded at once, straight into its place in text */
+		Container c;
+		unsigned int bad = 0;
+		if (containerOpen(&c, infile) != 0) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
+		if (c.flags != CONTAINER_FORMAT_4K) {
+			printf("??? %s: only lzsspa decodes this format\n", in);  return EXIT_FAILURE;
+		}
+		MappedFile text;  /* the parts are decoded straight into the output file */
+		if (mapOutput(&text, outfile, c.size) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
+		}
+		if (containerDecodeAll(&c, text.data, 0, Decode, &bad) != 0) {
+			if (bad < c.chunks) printf("??? %s: part %u is damaged\n", in, bad);
+			else printf("??? %s\n", in);
+			return EXIT_FAILURE;
+		}
+		if (unmapFile(&text) != 0) {
+			printf("??? %s\n", s);  return EXIT_FAILURE;
 		}
+		containerClose(&c);
 	}
 	fclose(infile);  fclose(outfile);
 	return EXIT_SUCCESS;
@@ -0,0 +1,96 @@
+/* C file that implements the file mappings specified in mapfile.h */
+
+#define _FILE_OFFSET_BITS 64
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "mapfile.h"
+
+
+/* Read the rest of fp into a growing buffer, for inputs that can't be mapped */
+
+static int readAll(MappedFile *m, FILE *fp){
+	size_t room = 1 << 16, n;
+	unsigned char *p;
+
+	m->data = (unsigned char *) malloc(room);
+	m->size = 0;  m->mapped = 0;
+	if (m->data == NULL) return -1;
+	while ((n = fread(m->data + m->size, 1, room - m->size, fp)) > 0) {
+		m->size += n;
+		if (m->size == room) {
+			if ((p = (unsigned char *) realloc(m->data, room * 2)) == NULL) {
+				free(m->data);  m->data = NULL;
+				return -1;
+			}
+			m->data = p;  room *= 2;
+		}
+	}
+	if (ferror(fp)) {
+		free(m->data);  m->data = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Map fp, falling back to readAll() for pipes and empty files */
+
+int mapInput(MappedFile *m, FILE *fp){
+	struct stat st;
+	void *p;
+
+	m->fp = NULL;
+	if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return readAll(m, fp);
+	p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (p == MAP_FAILED) return readAll(m, fp);
+	m->data = (unsigned char *) p;
+	m->size = (size_t) st.st_size;
+	m->mapped = 1;
+	return 0;
+}
+
+
+/* Size fp and map it shared, so the stores land in the file. fp has to be open
+for reading too since a mapping can't be write only. */
+
+int mapOutput(MappedFile *m, FILE *fp, size_t size){
+	void *p;
+
+	m->fp = fp;  m->size = size;  m->mapped = 0;
+	fflush(fp);
+	if (size > 0 && ftruncate(fileno(fp), (off_t) size) == 0) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fp), 0);
+		if (p != MAP_FAILED) {
+			m->data = (unsigned char *) p;
+			m->mapped = 1;
+			return 0;
+		}
+	}
+	m->data = (unsigned char *) malloc(size + 1);
+	return m->data == NULL ? -1 : 0;
+}
+
+
+/* Unmap m, or write out and free the buffer that stood in for a mapping */
+
+int unmapFile(MappedFile *m){
+	int result = 0;
+
+	if (m->mapped) {
+		munmap(m->data, m->size);
+	} else {
+		if (m->fp != NULL && m->size > 0
+		 && fwrite(m->data, 1, m->size, m->fp) != m->size) result = -1;
+		free(m->data);
+	}
+	m->data = NULL;
+	return result;
+}
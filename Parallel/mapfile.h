@@ -0,0 +1,45 @@
+/* Header file for reading and writing whole files through memory mappings
+Include this file in your code and link mapfile.c if you want the encoders and
+decoders to work on a file's bytes in place instead of copying them through stdio.
+
+mapInput() maps a file open for reading; mapOutput() sizes a file open for reading
+and writing ("w+b") and maps it. Anything that can't be mapped, like a pipe, is
+read into (or collected in) a malloc()ed buffer instead, so callers don't need to
+care which one they got.
+*/
+
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	unsigned char *data;	/* the bytes of the file */
+	size_t size;
+	int mapped;		/* 0 if data is a malloc()ed copy */
+	FILE *fp;		/* output: where unmapFile() writes a copy */
+} MappedFile;
+
+/* Map all of the file open for reading on fp, or read it into memory if it can't
+be mapped. Returns 0 on success, -1 on failure. */
+int mapInput(MappedFile *m, FILE *fp);
+
+/* Make the file open on fp size bytes long and map it for writing, or get a
+buffer of size bytes that unmapFile() writes to fp. Returns 0 on success, -1 on
+failure. */
+int mapOutput(MappedFile *m, FILE *fp, size_t size);
+
+/* Unmap (or free) m; an output that wasn't mapped is written to its file first.
+Returns 0 on success, -1 if that write failed. */
+int unmapFile(MappedFile *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
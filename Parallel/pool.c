@@ -0,0 +1,288 @@
+/* C file that implements the worker threads specified in pool.h */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+/* Each worker starts with its own run of task indices, [lo, hi), and takes
+them from the front. A worker whose run is empty steals the back half of the
+longest run left, so a slow task only holds up the tasks queued behind it on
+one worker until somebody else takes them. */
+
+typedef struct {
+	int lo, hi;		/* task indices this worker still has to run */
+	pthread_mutex_t lock;
+} Queue;
+
+typedef struct {
+	PoolTask task;
+	void *arg;
+	int threads;
+	Queue *queue;		/* one per worker */
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	int worker;
+} Worker;
+
+int poolCores(void){
+	const char *env = getenv("FLZSS_THREADS");
+	long n = env != NULL ? atol(env) : 0;
+
+	if (n < 1) n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : (int) n;
+}
+
+int poolThreads(int threads, int count){
+	if (threads <= 0) threads = poolCores();
+	if (threads > count) threads = count;
+	return threads < 1 ? 1 : threads;
+}
+
+/* next task of worker w from its own queue, or -1 if it is empty */
+static int take(Pool *pool, int w){
+	Queue *q = &pool->queue[w];
+	int i = -1;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->lo < q->hi) i = q->lo++;
+	pthread_mutex_unlock(&q->lock);
+	return i;
+}
+
+/* move the back half of the longest other queue to worker w's queue;
+returns 0 if there was nothing left to steal */
+static int steal(Pool *pool, int w){
+	Queue *q, *own = &pool->queue[w];
+	int v, n, victim = -1, most = 0, lo = 0, hi = 0;
+
+	for (v = 0; v < pool->threads; v++) {
+		if (v == w) continue;
+		q = &pool->queue[v];
+		pthread_mutex_lock(&q->lock);
+		n = q->hi - q->lo;
+		pthread_mutex_unlock(&q->lock);
+		if (n > most) {  most = n;  victim = v;  }
+	}
+	if (victim < 0) return 0;
+	q = &pool->queue[victim];
+	pthread_mutex_lock(&q->lock);
+	if (q->lo < q->hi) {
+		hi = q->hi;
+		lo = q->hi = q->hi - (q->hi - q->lo + 1) / 2;
+	}
+	pthread_mutex_unlock(&q->lock);
+	if (lo == hi) return 1;		/* lost the race, look again */
+	pthread_mutex_lock(&own->lock);
+	own->lo = lo;  own->hi = hi;
+	pthread_mutex_unlock(&own->lock);
+	return 1;
+}
+
+/* run tasks until no queue has any left */
+static void *work(void *p){
+	Worker *w = (Worker *) p;
+	Pool *pool = w->pool;
+	int i;
+
+	for ( ; ; ) {
+		if ((i = take(pool, w->worker)) >= 0) pool->task(pool->arg, i, w->worker);
+		else if (!steal(pool, w->worker)) break;
+	}
+	return NULL;
+}
+
+int poolRun(int threads, int count, PoolTask task, void *arg){
+	Pool pool;
+	Worker *workers;
+	pthread_t *tid;
+	int i, started;
+
+	if (count <= 0) return 0;
+	threads = poolThreads(threads, count);
+	pool.task = task;  pool.arg = arg;  pool.threads = threads;
+	pool.queue = (Queue *) malloc(sizeof(Queue) * threads);
+	workers = (Worker *) malloc(sizeof(Worker) * threads);
+	tid = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+	if (pool.queue == NULL || workers == NULL || tid == NULL) {
+		free(pool.queue);  free(workers);  free(tid);
+		return -1;
+	}
+	for (i = 0; i < threads; i++) {
+		pool.queue[i].lo = (int) ((long long) count * i / threads);
+		pool.queue[i].hi = (int) ((long long) count * (i + 1) / threads);
+		pthread_mutex_init(&pool.queue[i].lock, NULL);
+		workers[i].pool = &pool;  workers[i].worker = i;
+	}
+	/* worker 0 is the calling thread */
+	for (started = 1; started < threads; started++) {
+		if (pthread_create(&tid[started], NULL, work, &workers[started]) != 0)
+			break;  /* the ones already running steal the rest */
+	}
+	work(&workers[0]);
+	for (i = 1; i < started; i++) pthread_join(tid[i], NULL);
+	for (i = 0; i < threads; i++) pthread_mutex_destroy(&pool.queue[i].lock);
+	free(pool.queue);  free(workers);  free(tid);
+	return 0;
+}
+
+
+/* The cache is one array of every buffer it made, busy or idle. A take picks
+the smallest idle one that fits, if it is no more than twice the size asked
+for; sizes are rounded up to 1/8 of their top bit, so growing jobs reuse what
+the last one left. */
+
+typedef struct {
+	void *buf;
+	size_t size;
+	int busy;
+	unsigned long given;	/* when it was given back last */
+} CacheEntry;
+
+struct BufferCache {
+	void *(*alloc)(size_t size);
+	void (*release)(void *buf);
+	CacheEntry *entry;
+	int entries, room;
+	unsigned long clock;
+	pthread_mutex_t lock;
+};
+
+static size_t cacheRound(size_t size){
+	size_t step = 4096;
+
+	while (step * 16 <= size) step *= 2;
+	return (size + step - 1) / step * step;
+}
+
+BufferCache *cacheCreate(void *(*alloc)(size_t size), void (*release)(void *buf)){
+	BufferCache *cache = (BufferCache *) calloc(1, sizeof(BufferCache));
+
+	if (cache == NULL) return NULL;
+	cache->alloc = alloc;  cache->release = release;
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+void *cacheTake(BufferCache *cache, size_t size){
+	CacheEntry *e;
+	void *buf;
+	int i, best = -1;
+
+	size = cacheRound(size);
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->entries; i++) {
+		e = &cache->entry[i];
+		if (!e->busy && e->size >= size && e->size / 2 <= size
+				&& (best < 0 || e->size < cache->entry[best].size)) best = i;
+	}
+	if (best >= 0) {
+		cache->entry[best].busy = 1;
+		buf = cache->entry[best].buf;
+		pthread_mutex_unlock(&cache->lock);
+		return buf;
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if ((buf = cache->alloc(size)) == NULL) return NULL;  /* not under the lock */
+	pthread_mutex_lock(&cache->lock);
+	if (cache->entries == cache->room) {
+		int room = cache->room ? 2 * cache->room : 16;
+		e = (CacheEntry *) realloc(cache->entry, sizeof(CacheEntry) * room);
+		if (e == NULL) {
+			pthread_mutex_unlock(&cache->lock);
+			cache->release(buf);
+			return NULL;
+		}
+		cache->entry = e;  cache->room = room;
+	}
+	e = &cache->entry[cache->entries++];
+	e->buf = buf;  e->size = size;  e->busy = 1;  e->given = 0;
+	pthread_mutex_unlock(&cache->lock);
+	return buf;
+}
+
+/* take the idle buffer given back longest ago out of the cache, if more than
+count of them are idle or they hold more than bytes; NULL if none is taken */
+static void *evict(BufferCache *cache, int count, size_t bytes){
+	void *old = NULL;
+	size_t held = 0;
+	int i, idle = 0, oldest = -1;
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->entries; i++) {
+		CacheEntry *e = &cache->entry[i];
+		if (!e->busy) {
+			idle++;  held += e->size;
+			if (oldest < 0 || e->given < cache->entry[oldest].given) oldest = i;
+		}
+	}
+	if (idle > count || (idle > 0 && held > bytes)) {
+		old = cache->entry[oldest].buf;
+		cache->entry[oldest] = cache->entry[--cache->entries];
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return old;
+}
+
+void cacheGive(BufferCache *cache, void *buf){
+	void *old = NULL;
+	int i;
+
+	if (buf == NULL) return;
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->entries; i++) {
+		CacheEntry *e = &cache->entry[i];
+		if (e->buf != buf) continue;
+		if (e->size > CACHE_BYTES) {	/* a one off, not kept at all */
+			cache->entry[i] = cache->entry[--cache->entries];
+			old = buf;
+		} else {
+			e->busy = 0;  e->given = ++cache->clock;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	if (old != NULL) cache->release(old);
+	while ((old = evict(cache, CACHE_IDLE, CACHE_BYTES)) != NULL) cache->release(old);
+}
+
+void cacheTrim(BufferCache *cache, size_t bytes){
+	void *old;
+
+	while ((old = evict(cache, CACHE_IDLE, bytes)) != NULL) cache->release(old);
+}
+
+void cacheFree(BufferCache *cache){
+	int i;
+
+	if (cache == NULL) return;
+	for (i = 0; i < cache->entries; i++) cache->release(cache->entry[i].buf);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->entry);
+	free(cache);
+}
+
+static BufferCache *host_cache;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+
+static void hostCache(void){
+	host_cache = cacheCreate(malloc, free);
+}
+
+void *poolTake(size_t size){
+	pthread_once(&host_once, hostCache);
+	return host_cache != NULL ? cacheTake(host_cache, size) : NULL;
+}
+
+void poolGive(void *buf){
+	if (buf != NULL) cacheGive(host_cache, buf);
+}
+
+void poolTrim(size_t bytes){
+	if (host_cache != NULL) cacheTrim(host_cache, bytes);
+}
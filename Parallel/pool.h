@@ -0,0 +1,80 @@
+/* Header file for the worker threads shared by the parallel encoders and decoders
+Include this file in your code and link pool.c (and -pthread) if you want to run
+a number of independent tasks on all the cores of the machine.
+
+poolRun() starts the workers, hands them the task indices and returns once every
+task has finished. A task only learns its index and the worker running it, so
+anything a worker reuses between tasks (search trees, buffers) can be kept per
+worker instead of in globals.
+
+A BufferCache keeps the buffers given back to it for the next take of that size
+or a little less, so tasks, and the calls of a long running program, stop going
+to the allocator for every chunk. poolTake() and poolGive() use one of malloc()'ed
+buffers shared by the whole process. A cache of any other memory (pinned or
+device memory, say) is made with cacheCreate() and the two calls that get and
+release it.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One task: arg is the pointer given to poolRun(), index is in 0 .. count - 1 and
+worker in 0 .. threads - 1. */
+typedef void (*PoolTask)(void *arg, int index, int worker);
+
+/* Number of cores online, at least 1, or FLZSS_THREADS if the environment sets
+it, so every tool built on the pool can be run on fewer threads (bench/bench.c). */
+int poolCores(void);
+
+/* Workers poolRun() would start for count tasks when asked for threads threads:
+threads, or poolCores() if threads is 0 or less, but never more than count. */
+int poolThreads(int threads, int count);
+
+/* Run task(arg, i, worker) for every i in 0 .. count - 1 on poolThreads(threads,
+count) threads. Returns 0 once all of them have run, -1 if nothing could be allocated. */
+int poolRun(int threads, int count, PoolTask task, void *arg);
+
+typedef struct BufferCache BufferCache;
+
+/* Make a cache of the buffers alloc() makes and release() frees. alloc returns
+NULL on failure. Returns NULL if out of memory. */
+BufferCache *cacheCreate(void *(*alloc)(size_t size), void (*release)(void *buf));
+
+/* A buffer of at least size bytes, idle in the cache or new; NULL on failure.
+Safe to call from several threads at once, as is cacheGive(). */
+void *cacheTake(BufferCache *cache, size_t size);
+
+/* Give back a buffer cacheTake() returned. At most CACHE_IDLE buffers of
+CACHE_BYTES in all stay idle, and past that the ones given back longest ago are
+released. A buffer larger than CACHE_BYTES is released at once. */
+void cacheGive(BufferCache *cache, void *buf);
+
+/* Release the idle buffers given back longest ago until those left hold no more
+than bytes: 0 empties the cache of all but the busy ones. */
+void cacheTrim(BufferCache *cache, size_t bytes);
+
+/* Release every buffer of the cache, which must all have been given back, and
+the cache itself. */
+void cacheFree(BufferCache *cache);
+
+#define CACHE_IDLE	16
+#define CACHE_BYTES	((size_t) 256 << 20)
+
+/* cacheTake() and cacheGive() of the process's cache of malloc()'ed buffers. */
+void *poolTake(size_t size);
+void poolGive(void *buf);
+
+/* cacheTrim() of that cache, e.g. after a job much larger than the next ones. */
+void poolTrim(size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
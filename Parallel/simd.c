@@ -0,0 +1,138 @@
+/* C file that implements the match extension specified in simd.h */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+/* 8 bytes at a time: the lowest set bit of the XOR is the first byte that
+differs, on a little endian machine, and the highest on a big endian one */
+static int matchGeneric(const unsigned char *a, const unsigned char *b, int from, int limit){
+	unsigned long long x, y;
+	int i;
+
+	for (i = from; i < limit; i += 8) {
+		memcpy(&x, a + i, 8);  memcpy(&y, b + i, 8);
+		if ((x ^= y) != 0) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			i += __builtin_clzll(x) / 8;
+#else
+			i += __builtin_ctzll(x) / 8;
+#endif
+			return i < limit ? i : limit;
+		}
+	}
+	return limit;
+}
+
+#ifdef SIMD_X86
+static int matchSSE2(const unsigned char *a, const unsigned char *b, int from, int limit){
+	unsigned int m;
+	int i;
+
+	for (i = from; i < limit; i += 16) {
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+				_mm_loadu_si128((const __m128i *) (b + i)))) ^ 0xffff;
+		if (m != 0) {
+			i += __builtin_ctz(m);
+			return i < limit ? i : limit;
+		}
+	}
+	return limit;
+}
+
+__attribute__((target("avx2")))
+static int matchAVX2(const unsigned char *a, const unsigned char *b, int from, int limit){
+	unsigned int m;
+	int i;
+
+	for (i = from; i < limit; i += 32) {
+		m = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *) (a + i)),
+				_mm256_loadu_si256((const __m256i *) (b + i))));
+		if (m != 0) {
+			i += __builtin_ctz(m);
+			return i < limit ? i : limit;
+		}
+	}
+	return limit;
+}
+#endif
+
+#ifdef SIMD_NEON
+/* the compare narrowed to 4 bits per byte, so a 64 bit ctz finds the first
+byte that differs */
+static int matchNEON(const unsigned char *a, const unsigned char *b, int from, int limit){
+	unsigned long long m;
+	int i;
+
+	for (i = from; i < limit; i += 16) {
+		uint8x16_t eq = vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+		m = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+		if (m != 0) {
+			i += __builtin_ctzll(m) / 4;
+			return i < limit ? i : limit;
+		}
+	}
+	return limit;
+}
+#endif
+
+static const struct {
+	const char *name;
+	MatchFunction match;
+} versions[] = {
+#ifdef SIMD_X86
+	{ "avx2", matchAVX2 },
+	{ "sse2", matchSSE2 },
+#endif
+#ifdef SIMD_NEON
+	{ "neon", matchNEON },
+#endif
+	{ "generic", matchGeneric }
+};
+#define VERSIONS	(int) (sizeof(versions) / sizeof(versions[0]))
+
+static int chosen = VERSIONS - 1;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void choose(void){
+	const char *env = getenv("FLZSS_SIMD");
+	int i;
+
+	for (i = 0; env != NULL && i < VERSIONS; i++)
+		if (strcmp(versions[i].name, env) == 0) break;
+	if (env != NULL && i < VERSIONS) chosen = i;
+	else {
+#ifdef SIMD_X86
+		__builtin_cpu_init();
+		chosen = __builtin_cpu_supports("avx2") ? 0 : 1;
+#else
+		chosen = 0;
+#endif
+	}
+	simdMatch = versions[chosen].match;
+}
+
+/* the first call lands here, picks the version and hands over to it; the
+encoders call simdName() when they are made, so the threads using them find
+the right one already */
+static int matchFirst(const unsigned char *a, const unsigned char *b, int from, int limit){
+	pthread_once(&once, choose);
+	return simdMatch(a, b, from, limit);
+}
+
+MatchFunction simdMatch = matchFirst;
+
+const char *simdName(void){
+	pthread_once(&once, choose);
+	return versions[chosen].name;
+}
@@ -0,0 +1,37 @@
+/* Header file for the vector match extension of the LZSS coder
+Include this file in your code and link simd.c (and -pthread) if you want to find
+how far two strings agree 16 or 32 bytes at a time instead of one by one.
+
+simdMatch() picks the widest version the CPU runs the first time it is called:
+AVX2 (32 bytes) or SSE2 (16) on x86, NEON (16) on ARM, and otherwise 8 bytes
+through a 64 bit XOR. FLZSS_SIMD in the environment (avx2, sse2, neon or
+generic) forces one, for benchmarks and tests.
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes past limit that a match extension may read (never use), so every
+buffer it compares must have that many readable bytes after its end. */
+#define SIMD_PAD	32
+
+typedef int (*MatchFunction)(const unsigned char *a, const unsigned char *b, int from,
+		int limit);
+
+/* The first i in from .. limit - 1 where a[i] != b[i], or limit if they agree
+all the way. */
+extern MatchFunction simdMatch;
+
+/* Name of the version simdMatch() runs ("avx2", "sse2", "neon" or "generic"),
+choosing it if that hasn't happened yet. */
+const char *simdName(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+/* Test of the parse levels of libflzss: on every sample input, in every format,
+with the trees and with hash chains, --level 2 must come out no larger than
+--level 1, and every level must decode back to its input. Exits 0 if so. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flzss.h"
+
+#define SAMPLE_SIZE	(512 * 1024)
+
+static const char *words[] = {
+	"the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "with", "was",
+	"on", "be", "at", "by", "this", "had", "not", "are", "but", "from", "or", "have"
+};
+
+static unsigned int seed;
+
+static unsigned int nextRandom(void){
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+/* fills buf with sample kind, one of "text", "log", "records", "runs", "ff"
+and "random" */
+static void makeSample(const char *kind, unsigned char *buf, int size){
+	unsigned int minute, second, worker, id;
+	int i = 0, n;
+	char line[128];
+
+	seed = 12345;
+	if (strcmp(kind, "text") == 0) {
+		while (i < size) {
+			n = snprintf(line, sizeof(line), "%s ", words[nextRandom() % 24]);
+			if (nextRandom() % 12 == 0) line[n - 1] = '\n';
+			for (n = 0; line[n] != '\0' && i < size; n++) buf[i++] = line[n];
+		}
+	} else if (strcmp(kind, "log") == 0) {
+		while (i < size) {
+			minute = nextRandom() % 60;  second = nextRandom() % 60;
+			worker = nextRandom() % 16;  id = nextRandom();
+			snprintf(line, sizeof(line), "2026-10-14 12:%02u:%02u INFO [worker-%u] id=%u status=%u\n",
+					minute, second, worker, id, nextRandom() % 4 ? 200 : 404);
+			for (n = 0; line[n] != '\0' && i < size; n++) buf[i++] = line[n];
+		}
+	} else if (strcmp(kind, "records") == 0) {
+		for ( ; i < size; i++) buf[i] = i % 32 < 8 ? (unsigned char) (i / 32 >> (i % 4 * 8))
+				: i % 32 < 12 ? (unsigned char) (nextRandom() % 4) : (unsigned char) (i % 32);
+	} else if (strcmp(kind, "runs") == 0) {
+		while (i < size) {
+			unsigned char c = (unsigned char) nextRandom();
+			for (n = nextRandom() % 300; n > 0 && i < size; n--) buf[i++] = c;
+		}
+	} else if (strcmp(kind, "ff") == 0) {
+		memset(buf, 0xff, size);
+	} else {
+		for ( ; i < size; i++) buf[i] = (unsigned char) nextRandom();
+	}
+}
+
+int main(void){
+	const char *kinds[] = { "text", "log", "records", "runs", "ff", "random" };
+	const int depths[] = { 0, 16 };
+	unsigned char *in = (unsigned char *) malloc(SAMPLE_SIZE);
+	unsigned char *out = (unsigned char *) malloc(FLZSS_BOUND(SAMPLE_SIZE));
+	unsigned char *back = (unsigned char *) malloc(SAMPLE_SIZE);
+	int k, format, d, level, size[FLZSS_LEVEL_OPTIMAL + 1], failed = 0;
+
+	if (in == NULL || out == NULL || back == NULL) {
+		printf("??? out of memory\n");  return EXIT_FAILURE;
+	}
+	for (k = 0; k < 6; k++) {
+		makeSample(kinds[k], in, SAMPLE_SIZE);
+		for (format = 0; flzssWindow(format) > 0; format++)
+			for (d = 0; d < 2; d++) {
+				FlzssEncoder *e = flzssEncoderCreate(format, depths[d]);
+				FlzssDecoder *dec = flzssDecoderCreate(format);
+				if (e == NULL || dec == NULL) {
+					printf("??? out of memory\n");  return EXIT_FAILURE;
+				}
+				for (level = FLZSS_LEVEL_GREEDY; level <= FLZSS_LEVEL_OPTIMAL; level++) {
+					flzssEncoderLevel(e, level);
+					size[level] = flzssCompressChunk(e, in, SAMPLE_SIZE, out);
+					if (flzssDecompressChunk(dec, out, size[level], back, SAMPLE_SIZE)
+							!= SAMPLE_SIZE || memcmp(back, in, SAMPLE_SIZE) != 0) {
+						printf("FAIL %s, window %d, depth %d: level %d doesn't decode\n",
+								kinds[k], flzssWindow(format), depths[d], level);
+						failed = 1;
+					}
+				}
+				printf("%-8s %7d %2d: %7d %7d %7d%s\n", kinds[k], flzssWindow(format),
+						depths[d], size[0], size[1], size[2],
+						size[2] > size[1] ? "  FAIL level 2 is larger than level 1" : "");
+				if (size[2] > size[1]) failed = 1;
+				flzssEncoderFree(e);  flzssDecoderFree(dec);
+			}
+	}
+	free(in);  free(out);  free(back);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
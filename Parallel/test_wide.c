@@ -0,0 +1,59 @@
+/* Test of the wide windows of libflzss on the input their trees search worst:
+log lines whose time stamps and sequence numbers rise, so every string sorts
+after the last one of its line. Each of the 64 KB and 1 MB windows must encode
+TEXT_SIZE bytes of them within TIME_LIMIT seconds and decode them back.
+Exits 0 if so. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "flzss.h"
+
+#define TEXT_SIZE	(4 * 1024 * 1024)
+#define TIME_LIMIT	20.0	/* a search list as long as the window took minutes */
+
+static double seconds(void){
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(void){
+	unsigned char *in = (unsigned char *) malloc(TEXT_SIZE + 128);
+	unsigned char *out = (unsigned char *) malloc(FLZSS_BOUND(TEXT_SIZE));
+	unsigned char *back = (unsigned char *) malloc(TEXT_SIZE);
+	int i, n, size, format, failed = 0;
+	double start, time;
+
+	if (in == NULL || out == NULL || back == NULL) {
+		printf("??? out of memory\n");  return EXIT_FAILURE;
+	}
+	for (i = n = 0; n < TEXT_SIZE; i++)
+		n += sprintf((char *) in + n, "2026-10-14T%02d:%02d:%02d.%06d seq=%09d INFO request"
+				" handled path=/api/v1/items status=200\n", i / 36000 % 24, i / 600 % 60,
+				i / 10 % 60, i % 10 * 100000, i);
+	for (format = 1; flzssWindow(format) > 0; format++) {
+		FlzssEncoder *e = flzssEncoderCreate(format, 0);
+		FlzssDecoder *d = flzssDecoderCreate(format);
+		if (e == NULL || d == NULL) {
+			printf("??? out of memory\n");  return EXIT_FAILURE;
+		}
+		start = seconds();
+		size = flzssCompressChunk(e, in, TEXT_SIZE, out);
+		time = seconds() - start;
+		printf("window %7d: %d bytes to %d in %.2f s", flzssWindow(format), TEXT_SIZE, size, time);
+		if (time > TIME_LIMIT) {
+			printf("  FAIL slower than %.0f s", TIME_LIMIT);  failed = 1;
+		}
+		if (flzssDecompressChunk(d, out, size, back, TEXT_SIZE) != TEXT_SIZE
+		 || memcmp(back, in, TEXT_SIZE) != 0) {
+			printf("  FAIL doesn't decode");  failed = 1;
+		}
+		printf("\n");
+		flzssEncoderFree(e);  flzssDecoderFree(d);
+	}
+	free(in);  free(out);  free(back);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
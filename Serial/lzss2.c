@@ -14,6 +14,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #define N		 4096	/* size of ring buffer */
 #define F		   18	/* upper limit for match_length */
@@ -102,7 +103,7 @@ void DeleteNode(int p)  /* deletes node p from tree */
 	dad[p] = NIL;
 }
 
-void Encode(FILE * in, FILE * out, int upper)
+void Encode(const unsigned char * in, FILE * out, unsigned long upper)
 {
 	int  i, c, len, r, s, last_match_length, code_buf_ptr;
 	unsigned char  code_buf[17], mask;
@@ -111,8 +112,7 @@ void Encode(FILE * in, FILE * out, int upper)
 	unsigned long int
 			textsize = 0,	/* text size counter */
 			textcount = 0,	/* second text size counter */
-			codesize = 0,	/* code size counter */
-			printcount = 0;	/* counter for reporting progress every 1K bytes */
+			codesize = 0;	/* code size counter */
 	
 	InitTree();  /* initialize trees */
 	code_buf[0] = 0;  /* code_buf[1..16] saves eight units of code, and
@@ -123,9 +123,9 @@ void Encode(FILE * in, FILE * out, int upper)
 	s = 0;  r = N - F;
 	for (i = s; i < r; i++) text_buf[i] = ' ';  /* Clear the buffer with
 		any character that will appear often. */
-	for (len = 0; len < F && (c = getc(in)) != EOF && ++textcount <= upper; len++)
-		text_buf[r + len] = c;  /* Read F bytes into the last F bytes of
-			the buffer */
+	for (len = 0; len < F && textcount < upper; len++)
+		text_buf[r + len] = in[textcount++];  /* Read F bytes into the last
+			F bytes of the buffer */
 	if ((textsize = len) == 0) return;  /* text of size zero */
 	for (i = 1; i <= F; i++) InsertNode(r - i);  /* Insert the F strings,
 		each of which begins with one or more 'space' characters.  Note
@@ -148,14 +148,14 @@ void Encode(FILE * in, FILE * out, int upper)
 					length pair. Note match_length > THRESHOLD. */
 		}
 		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-			for (i = 0; i < code_buf_ptr; i++)  /* Send at most 8 units of */
-				putc(code_buf[i], out);     /* code together */
+			fwrite(code_buf, 1, code_buf_ptr, out);  /* Send at most 8 units of
+				code together */
 			codesize += code_buf_ptr;
 			code_buf[0] = 0;  code_buf_ptr = mask = 1;
 		}
 		last_match_length = match_length;
-		for (i = 0; i < last_match_length &&
-				(c = getc(in)) != EOF && ++textcount <= upper; i++) {
+		for (i = 0; i < last_match_length && textcount < upper; i++) {
+			c = in[textcount++];
 			DeleteNode(s);		/* Delete old strings and */
 			text_buf[s] = c;	/* read new bytes */
 			if (s < F - 1) text_buf[s + N] = c;  /* If the position is
@@ -166,11 +166,7 @@ void Encode(FILE * in, FILE * out, int upper)
 				   modulo N. */
 			InsertNode(r);	/* Register the string in text_buf[r..r+F-1] */
 		}
-		if ((textsize += i) > printcount) {
-			printf("%12ld\r", textsize);  printcount += 1024;
-				/* Reports progress each time the textsize exceeds
-				   multiples of 1024. */
-		}
+		textsize += i;
 		while (i++ < last_match_length) {	/* After the end of text, */
 			DeleteNode(s);					/* no need to read, but */
 			s = (s + 1) & (N - 1);  r = (r + 1) & (N - 1);
@@ -178,7 +174,7 @@ void Encode(FILE * in, FILE * out, int upper)
 		}
 	} while (len > 0);	/* until length of string to be processed is zero */
 	if (code_buf_ptr > 1) {		/* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++) putc(code_buf[i], out);
+		fwrite(code_buf, 1, code_buf_ptr, out);
 		codesize += code_buf_ptr;
 	}
 	printf("In : %ld bytes\n", textsize);	/* Encoding is done. */
@@ -232,19 +228,26 @@ int main(int argc, char *argv[])
 	}
 	if (toupper(*argv[1]) == 'E'){
 		stat(argv[2], &st);
-		int size = st.st_size;
-		printf("%d\n",size);
-		int part = 0, seeksize = size/PARTITIONS;
+		size_t size = st.st_size;
+		printf("%llu\n", (unsigned long long) size);
+		int part = 0;
+		size_t seeksize = size/PARTITIONS;
+		/* Encode() reads the parts straight from the mapped file */
+		unsigned char * text = size > 0 ? (unsigned char *) mmap(NULL, size, PROT_READ,
+				MAP_PRIVATE, fileno(infile), 0) : NULL;
+		if (text == MAP_FAILED) {
+			printf("??? %s\n", in);  return EXIT_FAILURE;
+		}
 		remove(s);
 		for(part = 0; part < PARTITIONS; part++){
-			fseek(infile, seeksize*part, SEEK_SET);
 			printf("%.2f%%\n",part/(float)PARTITIONS);
 			sprintf(s,"%s.%d",s,part);
 			FILE * out = fopen(s, "wb");
 			s[strlen(s)-2] = '\0';
-			Encode(infile, out, seeksize+(part==PARTITIONS ? size%PARTITIONS:0));
+			Encode(text + seeksize*part, out, seeksize+(part==PARTITIONS-1 ? size%PARTITIONS:0));
 			fclose(out);
 		}
+		if (text != NULL) munmap(text, size);
 	} else {
 		int part = 0;
 		for(part = 0; part < PARTITIONS; part++){
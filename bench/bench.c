@@ -0,0 +1,418 @@
+/* Benchmark of every LZSS engine in this tree on the same inputs
+
+Runs each engine's binary (built as the READMEs say) over a generated corpus, text,
+logs, binary records and random bytes, at a few sizes and thread counts. Every run
+encodes, decodes and compares with the input, and reports the ratio, MB/s both
+ways, the peak RSS of either pass and, for the CUDA engines, the upload, kernel and
+download time of the device. One line (CSV) or object (JSON) per run goes to stdout.
+*/
+
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_LIST	16	/* sizes or thread counts on one command line */
+#define COPY_BUF	(64 * 1024)
+#define PATH_SIZE	1024
+
+typedef struct {
+	const char *name;
+	const char *path;	/* of the binary, from the top of the tree */
+	const char *encode, *decode;	/* mode arguments */
+	int options;		/* takes -i file -o file instead of two file names */
+	int pooled;		/* runs on pool.c, so FLZSS_THREADS applies */
+	int parts;		/* writes file.0 .. file.(parts - 1) instead of file */
+} Engine;
+
+static const Engine engines[] = {
+	{ "serial", "Serial/lzss2", "e", "d", 0, 0, 5 },
+	{ "fork", "Parallel/lzssp", "e", "d", 0, 0, 0 },
+	{ "pool", "Parallel/lzsspa", "e", "d", 0, 1, 0 },
+	{ "pool-hash", "Parallel/lzsspa", "h", "d", 0, 1, 0 },
+	{ "pool-64k", "Parallel/lzsspa", "e", "d", 0, 1, 0 },
+	{ "pool-huffman", "Parallel/lzsspa", "e", "d", 0, 1, 0 },
+	{ "lzsspu", "Parallel/lzsspu", "e", "d", 0, 1, 0 },
+	{ "cuda", "Parallel/lzsspa_cuda", "e", "u", 0, 0, 0 },
+	{ "cuda-grid", "Parallel/lzsspa_cuda", "g", "u", 0, 0, 0 },
+	{ "cuda-warp", "Parallel/lzsspa_cuda", "w", "u", 0, 0, 0 },
+	{ "cuda-stream", "Parallel/lzsspa_cuda", "s", "u", 0, 0, 0 },
+	{ "hybrid", "Parallel/lzsspa_cuda", "b", "d", 0, 1, 0 },
+	{ "cuda-multi", "Parallel/lzsspa_cuda", "m", "u", 0, 0, 0 },
+	{ "pfac", "PFAC/lzssx", "-c", "-d", 1, 0, 0 }
+};
+#define ENGINES	(int) (sizeof(engines) / sizeof(engines[0]))
+
+/* what an engine adds after its file names, if anything */
+static const char *extra(const Engine *e){
+	if (strcmp(e->name, "pool-64k") == 0) return "64k";
+	if (strcmp(e->name, "pool-huffman") == 0) return "--huffman";
+	return NULL;
+}
+
+static const char *corpora[] = { "text", "logs", "binary", "random" };
+#define CORPORA	(int) (sizeof(corpora) / sizeof(corpora[0]))
+
+typedef struct {
+	int ok;
+	double seconds;
+	long rss;		/* KB */
+	double gpu[3];		/* ms of upload, kernel, download; -1 if not timed */
+} Run;
+
+static unsigned long long seed;
+
+/* xorshift64*, the same stream on every machine */
+static unsigned long long next(void){
+	seed ^= seed >> 12;  seed ^= seed << 25;  seed ^= seed >> 27;
+	return seed * 2685821657736338717ull;
+}
+
+static const char *words[] = {
+	"the", "of", "and", "to", "a", "in", "is", "it", "that", "was", "for", "on",
+	"are", "with", "as", "his", "they", "be", "at", "one", "have", "this", "from",
+	"by", "hot", "word", "but", "what", "some", "we", "can", "out", "other", "were",
+	"all", "there", "when", "up", "use", "your", "how", "said", "an", "each", "she",
+	"which", "do", "their", "time", "if", "will", "way", "about", "many", "then",
+	"them", "write", "would", "like", "so", "these", "her", "long", "make", "thing",
+	"see", "him", "two", "has", "look", "more", "day", "could", "go", "come",
+	"compression", "window", "buffer", "pattern", "sliding", "dictionary", "match"
+};
+#define WORDS	(int) (sizeof(words) / sizeof(words[0]))
+
+/* a word, the common ones far more often than the rest */
+static const char *word(void){
+	unsigned long long r = next();
+	return words[(r % WORDS) * ((r >> 32) % WORDS) / WORDS];
+}
+
+/* writes size bytes of the corpus into fp */
+static void generate(const char *corpus, size_t size, FILE *fp){
+	static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+	static const char *paths[] = { "/api/v1/items", "/api/v1/users", "/static/app.js",
+		"/health", "/api/v2/search" };
+	char line[256];
+	size_t done = 0, n;
+	unsigned long long r, t = 1791936000ull * 1000;  /* ms since 1970 */
+	unsigned int id = 1;
+	int i, k;
+
+	seed = 0x9e3779b97f4a7c15ull ^ corpus[0];
+	while (done < size) {
+		if (strcmp(corpus, "text") == 0) {
+			for (n = 0, k = 0; k < 12; k++) {
+				n += sprintf(line + n, "%s%s", k ? " " : "", word());
+				if (n > 180) break;
+			}
+			n += sprintf(line + n, "%s\n", next() % 4 ? "," : ".");
+		} else if (strcmp(corpus, "logs") == 0) {
+			r = next();
+			t += r % 250;
+			n = sprintf(line, "%llu.%03llu %-5s [worker-%llu] GET %s/%llu status=%d bytes=%llu %llums\n",
+					t / 1000, t % 1000, levels[r % 6], (r >> 8) % 16, paths[(r >> 12) % 5],
+					(r >> 16) % 100000, (r >> 40) % 20 ? 200 : 404, (r >> 20) % 65536, (r >> 44) % 900);
+		} else if (strcmp(corpus, "binary") == 0) {
+			/* 32 byte records: ids, small types, slowly moving values, padding */
+			r = next();
+			memset(line, 0, 32);
+			for (i = 0; i < 4; i++) line[i] = id >> (8 * i);
+			line[4] = r % 7;  line[5] = (r >> 3) % 3;
+			for (i = 0; i < 4; i++) line[8 + i] = (id * 37 + (r >> 8) % 5) >> (8 * i);
+			for (i = 0; i < 6; i++) line[16 + i] = (r >> (16 + i * 4)) & (i < 2 ? 0xff : 0x0f);
+			n = 32;  id++;
+		} else {
+			for (n = 0; n < 64; n += 8) {
+				r = next();
+				memcpy(line + n, &r, 8);
+			}
+		}
+		if (n > size - done) n = size - done;
+		fwrite(line, 1, n, fp);
+		done += n;
+	}
+}
+
+static double now(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* runs argv with its output in log, on threads pool threads if threads > 0,
+and fills in how long it took and its peak RSS; returns its exit status, or -1
+if it couldn't run */
+static int run(char *const argv[], const char *log, int threads, Run *r){
+	struct rusage ru;
+	char count[16];
+	double start = now();
+	pid_t pid;
+	int fd, status;
+
+	if ((pid = fork()) < 0) return -1;
+	if (pid == 0) {
+		if (threads > 0) {
+			sprintf(count, "%d", threads);
+			setenv("FLZSS_THREADS", count, 1);
+		}
+		if ((fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+			dup2(fd, 1);  dup2(fd, 2);
+			close(fd);
+		}
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) != pid) return -1;
+	r->seconds = now() - start;
+	if (ru.ru_maxrss > r->rss) r->rss = ru.ru_maxrss;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* the "gpu:" line lzsspa_cuda prints, if the log has one */
+static void readGpuTimes(const char *log, double gpu[3]){
+	char line[512];
+	FILE *fp = fopen(log, "r");
+
+	if (fp == NULL) return;
+	while (fgets(line, sizeof(line), fp) != NULL)
+		if (sscanf(line, "gpu: upload %lf ms, kernel %lf ms, download %lf ms",
+				&gpu[0], &gpu[1], &gpu[2]) == 3) break;
+	fclose(fp);
+}
+
+static long long fileSize(const char *name){
+	struct stat st;
+
+	return stat(name, &st) != 0 ? -1 : (long long) st.st_size;
+}
+
+/* bytes the engine wrote for coded, and with remove set deletes them */
+static long long codedSize(const Engine *e, const char *coded, int remove_them){
+	char part[PATH_SIZE];
+	long long total = 0, n;
+	int i;
+
+	if (e->parts == 0) {
+		total = fileSize(coded);
+		if (remove_them) remove(coded);
+		return total;
+	}
+	for (i = 0; i < e->parts; i++) {
+		snprintf(part, PATH_SIZE, "%s.%d", coded, i);
+		if ((n = fileSize(part)) > 0) total += n;
+		if (remove_them) remove(part);
+	}
+	return total;
+}
+
+/* 1 if the two files hold the same bytes */
+static int same(const char *a, const char *b){
+	static char x[COPY_BUF], y[COPY_BUF];
+	FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+	size_t n, m;
+	int equal = fa != NULL && fb != NULL;
+
+	while (equal) {
+		n = fread(x, 1, COPY_BUF, fa);
+		m = fread(y, 1, COPY_BUF, fb);
+		if (n != m || memcmp(x, y, n) != 0) equal = 0;
+		if (n < COPY_BUF) break;
+	}
+	if (fa != NULL) fclose(fa);
+	if (fb != NULL) fclose(fb);
+	return equal;
+}
+
+/* argv for one pass of e: mode from to, and whatever the engine adds.
+lzss2 appends .0 and so on to the name it is given in place, so what it gets
+is a copy with room for that. */
+static void command(const Engine *e, const char *binary, const char *mode,
+		const char *from, const char *to, int encoding, char *argv[8]){
+	static char name[PATH_SIZE];
+	int n = 0;
+
+	if (e->parts > 0) {
+		snprintf(name, PATH_SIZE, encoding ? "%s" : "%s.0", encoding ? to : from);
+		if (encoding) to = name;
+		else from = name;
+	}
+
+	argv[n++] = (char *) binary;
+	if (e->options) {
+		argv[n++] = (char *) mode;
+		argv[n++] = "-i";  argv[n++] = (char *) from;
+		argv[n++] = "-o";  argv[n++] = (char *) to;
+	} else {
+		argv[n++] = (char *) mode;
+		argv[n++] = (char *) from;  argv[n++] = (char *) to;
+		if (encoding && extra(e) != NULL) argv[n++] = (char *) extra(e);
+	}
+	argv[n] = NULL;
+}
+
+/* parses a list like 1,16,64 into list, returns how many */
+static int parseList(const char *s, int list[MAX_LIST]){
+	int n = 0;
+	char *end;
+
+	while (*s && n < MAX_LIST) {
+		list[n] = (int) strtol(s, &end, 10);
+		if (end == s || list[n] < 0) return -1;
+		n++;
+		s = *end == ',' ? end + 1 : end;
+		if (*end != ',' && *end) return -1;
+	}
+	return n;
+}
+
+/* one number of a row, or nothing (null in JSON) if it wasn't measured */
+static const char *field(char buf[32], const char *format, double v, int valid, int json){
+	if (!valid) return json ? "null" : "";
+	snprintf(buf, 32, format, v);
+	return buf;
+}
+
+/* one run as a CSV line or, after a comma unless it is the first, a JSON object */
+static void printRow(int json, int first, const char *corpus, size_t size, const char *engine,
+		int threads, long long csize, const Run *enc, const Run *dec){
+	static const char *names[] = { "ratio", "compress_mbs", "decompress_mbs", "peak_rss_kb",
+		"gpu_upload_ms", "gpu_kernel_ms", "gpu_download_ms" };
+	char buf[7][32];
+	const char *v[7];
+	int i;
+
+	v[0] = field(buf[0], "%.4f", size ? (double) csize / size : 0, enc->ok && csize >= 0, json);
+	v[1] = field(buf[1], "%.2f", size / 1e6 / enc->seconds, enc->ok && enc->seconds > 0, json);
+	v[2] = field(buf[2], "%.2f", size / 1e6 / dec->seconds, dec->ok && dec->seconds > 0, json);
+	v[3] = field(buf[3], "%.0f", enc->rss > dec->rss ? enc->rss : dec->rss, enc->ok, json);
+	for (i = 0; i < 3; i++)
+		v[4 + i] = field(buf[4 + i], "%.3f", enc->gpu[i], enc->ok && enc->gpu[i] >= 0, json);
+	if (json) {
+		printf("%s\n  {\"corpus\": \"%s\", \"size\": %zu, \"engine\": \"%s\", \"threads\": %d",
+				first ? "" : ",", corpus, size, engine, threads);
+		for (i = 0; i < 7; i++) printf(", \"%s\": %s", names[i], v[i]);
+		printf(", \"ok\": %s}", dec->ok ? "true" : "false");
+	} else {
+		printf("%s,%zu,%s,%d", corpus, size, engine, threads);
+		for (i = 0; i < 7; i++) printf(",%s", v[i]);
+		printf(",%d\n", dec->ok);
+	}
+}
+
+static void usage(void){
+	int i;
+
+	printf("'bench [options] [engine ...]' runs every engine (or the ones named) on\n"
+		"the corpus and prints one line per run.\n"
+		"  --json        objects instead of CSV lines\n"
+		"  --sizes 1,16  corpus sizes in MB (1 and 16 by default)\n"
+		"  --threads 1,4 pool threads to try (1 and every core by default)\n"
+		"  --root dir    top of the tree, where the binaries are (.)\n"
+		"  --dir dir     where the corpus and the coded files go (/tmp/flzss-bench)\n"
+		"engines:");
+	for (i = 0; i < ENGINES; i++) printf(" %s", engines[i].name);
+	printf("\n");
+}
+
+int main(int argc, char *argv[]){
+	const char *root = ".", *dir = "/tmp/flzss-bench";
+	int sizes[MAX_LIST] = { 1, 16 }, threads[MAX_LIST] = { 1, 0 };
+	int nsizes = 2, nthreads = 2, json = 0, rows = 0, failed = 0;
+	int chosen[ENGINES];
+	int i, j, k, t, named = 0;
+	char binary[PATH_SIZE], input[PATH_SIZE], decoded[PATH_SIZE], log[PATH_SIZE];
+	char coded[PATH_SIZE - 16];	/* room for what goes after it */
+	char *args[8];
+
+	memset(chosen, 0, sizeof(chosen));
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0) json = 1;
+		else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+			if ((nsizes = parseList(argv[++i], sizes)) <= 0) {
+				printf("??? %s\n", argv[i]);  return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			if ((nthreads = parseList(argv[++i], threads)) <= 0) {
+				printf("??? %s\n", argv[i]);  return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) root = argv[++i];
+		else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) dir = argv[++i];
+		else {
+			for (j = 0; j < ENGINES && strcmp(engines[j].name, argv[i]) != 0; j++);
+			if (j == ENGINES) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			chosen[j] = named = 1;
+		}
+	}
+	if (!named)
+		for (j = 0; j < ENGINES; j++) chosen[j] = 1;
+	for (t = 0; t < nthreads; t++)
+		if (threads[t] == 0) threads[t] = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	mkdir(dir, 0755);
+
+	if (json) printf("[");
+	else printf("corpus,size,engine,threads,ratio,compress_mbs,decompress_mbs,peak_rss_kb,"
+			"gpu_upload_ms,gpu_kernel_ms,gpu_download_ms,ok\n");
+	for (i = 0; i < CORPORA; i++)
+		for (k = 0; k < nsizes; k++) {
+			size_t size = (size_t) sizes[k] << 20;
+			FILE *fp;
+
+			snprintf(input, PATH_SIZE, "%s/%s-%dm", dir, corpora[i], sizes[k]);
+			if (fileSize(input) != (long long) size) {
+				if ((fp = fopen(input, "wb")) == NULL) {
+					printf("??? %s\n", input);  return EXIT_FAILURE;
+				}
+				generate(corpora[i], size, fp);
+				fclose(fp);
+			}
+			for (j = 0; j < ENGINES; j++) {
+				const Engine *e = &engines[j];
+
+				if (!chosen[j]) continue;
+				snprintf(binary, PATH_SIZE, "%s/%s", root, e->path);
+				if (access(binary, X_OK) != 0) {
+					if (i == 0 && k == 0) fprintf(stderr, "%s: no %s, skipped\n", e->name, binary);
+					continue;
+				}
+				snprintf(coded, sizeof(coded), "%s/%s-%dm.%s", dir, corpora[i], sizes[k], e->name);
+				snprintf(decoded, PATH_SIZE, "%s.out", coded);
+				snprintf(log, PATH_SIZE, "%s.log", coded);
+				for (t = 0; t < (e->pooled ? nthreads : 1); t++) {
+					Run enc, dec;
+					long long csize;
+					int n = e->pooled ? threads[t] : 0;
+
+					memset(&enc, 0, sizeof(enc));  memset(&dec, 0, sizeof(dec));
+					enc.gpu[0] = enc.gpu[1] = enc.gpu[2] = -1;
+					command(e, binary, e->encode, input, coded, 1, args);
+					enc.ok = run(args, log, n, &enc) == 0;
+					readGpuTimes(log, enc.gpu);
+					command(e, binary, e->decode, coded, decoded, 0, args);
+					dec.ok = enc.ok && run(args, log, n, &dec) == 0 && same(input, decoded);
+					csize = codedSize(e, coded, 0);
+					if (!dec.ok) failed++;
+
+					printRow(json, rows == 0, corpora[i], size, e->name, n, csize, &enc, &dec);
+					fflush(stdout);
+					rows++;
+				}
+				codedSize(e, coded, 1);
+				remove(decoded);  remove(log);
+			}
+		}
+	if (json) printf("\n]\n");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,238 +1,247 @@
 //Huffman code
+/* C file that implements the entropy stage specified in huffman.h */
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-struct node{
-	int value;
-	char ch;
-	struct node *lson, *rson;
-};
-
-typedef struct node Node;
-
-typedef struct queue{
-	Node * n;
-	struct queue * next;
-} Queue;
-
-Queue * head;
-
-Queue * createQueue(){
-	Queue * q = malloc(sizeof(Queue));
-	q -> next = NULL;
-	q -> n = NULL;
-	return q;
+#include "huffman.h"
+
+#define COUNT_SLICE	(1024 * 1024)	/* bytes counted into one set of bins at a time */
+
+/* One leaf of the code: its count, which in place becomes a parent index
+   and then a depth while huffLengths() runs, and its byte value. */
+typedef struct {
+	unsigned long long key;
+	int ch;
+} Leaf;
+
+/* sorts the n keys in place, smallest first, through an array heap */
+static void heapSort(unsigned long long a[], int n){
+	unsigned long long t;
+	int i, j, k, end;
+
+	for (end = n, i = n / 2 - 1; end > 1; ) {
+		if (i >= 0) k = i--;		/* still building the heap */
+		else {				/* the largest goes to the end */
+			t = a[0];  a[0] = a[--end];  a[end] = t;
+			k = 0;
+		}
+		for (t = a[k]; (j = 2 * k + 1) < end; k = j) {  /* sift down */
+			if (j + 1 < end && a[j + 1] > a[j]) j++;
+			if (a[j] <= t) break;
+			a[k] = a[j];
+		}
+		a[k] = t;
+	}
 }
 
-void push(Node * n){
-	//printf("Push: %d \n", n->value);
-	if(head == NULL){
-		head = createQueue();
-	}
-	if(head->n == NULL) {
-		head->n = n;
+/* Moffat and Katajainen's in place code lengths: the n leaves, rarest
+   first, are joined in the same array (the internal nodes are made in
+   order, so the nodes still to join form a second queue behind the leaves
+   still to join), then the parent links become depths, and the depths of
+   the internal nodes are handed out to the leaves. */
+static void minimumRedundancy(Leaf a[], int n){
+	int root, leaf, next, avail, used, depth;
+
+	if (n == 1) {
+		a[0].key = 1;
 		return;
 	}
-	Queue *q = head, * q_next = createQueue();
-	q_next->n = n;
-	while(q->next != NULL){
-		if(n->value <= q->next->n->value) break;
-		q = q->next;
+	a[0].key += a[1].key;  root = 0;  leaf = 2;
+	for (next = 1; next < n - 1; next++) {
+		if (leaf >= n || a[root].key < a[leaf].key) {  /* first child */
+			a[next].key = a[root].key;  a[root++].key = next;
+		} else a[next].key = a[leaf++].key;
+		if (leaf >= n || (root < next && a[root].key < a[leaf].key)) {  /* second */
+			a[next].key += a[root].key;  a[root++].key = next;
+		} else a[next].key += a[leaf++].key;
 	}
-	if(q == head && n->value < q->n->value){
-		q_next -> next = q;
-		head = q_next;
+	a[n - 2].key = 0;  /* the root; every other node holds its parent */
+	for (next = n - 3; next >= 0; next--) a[next].key = a[a[next].key].key + 1;
+	avail = 1;  used = depth = 0;  root = n - 2;  next = n - 1;
+	while (avail > 0) {
+		while (root >= 0 && a[root].key == (unsigned long long) depth) {
+			used++;  root--;
+		}
+		while (avail > used) {
+			a[next--].key = depth;  avail--;
+		}
+		avail = 2 * used;  depth++;  used = 0;
 	}
-	q_next -> next = q->next;
-	q->next = q_next;
-}
-
-int isEmpty(){
-	return head==NULL ? 1:0;
 }
 
-int isAlone(){
-	return head->next == NULL ? 1:0;
-}
-
-Node * pop(){
-	Node * n = head -> n;
-	Queue * h = head;
-	head = head -> next;
-	if(head != NULL)
-		free(h);
-	return n;
+/* adds the counts of in to freq.  Four sets of bins, so that a run of the
+   same byte doesn't wait on one counter; none of them sees more than
+   COUNT_SLICE bytes at a time. */
+static void countInto(const unsigned char *in, size_t size, unsigned long long freq[256]){
+	unsigned int bins[4][256];
+	size_t i, n;
+	int j;
+
+	while (size > 0) {
+		n = size < COUNT_SLICE ? size : COUNT_SLICE;
+		memset(bins, 0, sizeof(bins));
+		for (i = 0; i + 4 <= n; i += 4) {
+			bins[0][in[i]]++;  bins[1][in[i + 1]]++;
+			bins[2][in[i + 2]]++;  bins[3][in[i + 3]]++;
+		}
+		for ( ; i < n; i++) bins[0][in[i]]++;
+		for (j = 0; j < 256; j++) freq[j] += bins[0][j] + bins[1][j] + bins[2][j] + bins[3][j];
+		in += n;  size -= n;
+	}
 }
 
-Node * peek(){
-	return head -> n;
+void huffCount(const unsigned char *in, size_t size, unsigned long long freq[256]){
+	memset(freq, 0, sizeof(unsigned long long) * 256);
+	countInto(in, size, freq);
 }
 
-//Find if a character is in a string and that characters position
-int contains(char, char *, int);
-void quickSort();
-void count();
-int partition();
-Node * huffmanTree();
-void printTree();
-void printQueue();
-
-
-
-int reps[256] = {};
-char chars[256] = {EOF};
-int uniq = 0;
+int huffLengths(const unsigned long long freq[256], unsigned char len[256]){
+	Leaf leaves[256];
+	unsigned long long keys[256];
+	int count[HUFF_MAX_BITS + 1];
+	unsigned int kraft = 0;
+	int i, j, n = 0, longest = 0;
 
-Node * nodes[256];
+	memset(len, 0, 256);
+	for (i = 0; i < 256; i++)  /* rarest first, ties by value */
+		if (freq[i] > 0) keys[n++] = (freq[i] < 1ull << 55 ? freq[i] : 1ull << 55) << 8 | i;
+	if (n == 0) return 0;
+	heapSort(keys, n);
+	for (i = 0; i < n; i++) {
+		leaves[i].key = keys[i] >> 8;  leaves[i].ch = keys[i] & 0xff;
+	}
+	minimumRedundancy(leaves, n);
+
+	/* only the number of codes of each length matters now: cut the deep
+	   ones to HUFF_MAX_BITS, then, while the code is oversubscribed, move
+	   one of them up next to the deepest shorter leaf, which becomes two */
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		count[leaves[i].key < HUFF_MAX_BITS ? leaves[i].key : HUFF_MAX_BITS]++;
+	for (i = 1; i <= HUFF_MAX_BITS; i++) kraft += (unsigned int) count[i] << (HUFF_MAX_BITS - i);
+	while (kraft > 1u << HUFF_MAX_BITS) {
+		count[HUFF_MAX_BITS]--;
+		for (i = HUFF_MAX_BITS - 1; count[i] == 0; i--);
+		count[i]--;  count[i + 1] += 2;
+		kraft--;
+	}
 
-Node * createNode(){
-	Node * n = malloc(sizeof(Node));
-	n -> lson = NULL;
-	n -> rson = NULL;
-	return n;
+	/* the longest codes go to the rarest values */
+	for (i = HUFF_MAX_BITS, j = 0; i > 0; i--)
+		for ( ; count[i] > 0; count[i]--) {
+			len[leaves[j++].ch] = i;
+			if (i > longest) longest = i;
+		}
+	return longest;
 }
 
-int main(int argc, char * argv[]){
-	char ch;
-	char str[40960];
-	int i = 0;
-	while((ch=getc(stdin))!=EOF){
-		str[i++] = ch;
-	}
-	int size = strlen(str);
-//	quickSort(argv[1], 0, size);
-//	argv[1][0] = ' ';
-//	printf("%s\n%d\n", argv[1], size);
-	huffmanTree(str,size);
-	return 0;
-}
+void huffCodes(const unsigned char len[256], unsigned short code[256]){
+	int count[HUFF_MAX_BITS + 1], next[HUFF_MAX_BITS + 1];
+	int i, c = 0;
 
-void count(char arr[], int size){
-	int i = 0, pos = -1;
-	for(i=0;i<size;i++) {
-		pos = contains(arr[i], chars, uniq);
-		if(pos > 0) {
-			reps[pos]++;
-		} else {
-			chars[uniq] = arr[i];
-			reps[uniq]++;
-			uniq++; 
-		}
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < 256; i++) count[len[i]]++;
+	count[0] = 0;
+	for (i = 1; i <= HUFF_MAX_BITS; i++) {
+		c = (c + count[i - 1]) << 1;
+		next[i] = c;
 	}
+	for (i = 0; i < 256; i++) code[i] = len[i] ? next[len[i]]++ : 0;
 }
 
-int contains(char ch, char arr[], int size){
-	int i=0;
-	for(i=0; i<size; i++){
-		if(ch==arr[i]) return i;
+void huffTable(const unsigned char len[256], unsigned short table[1 << HUFF_MAX_BITS]){
+	unsigned short code[256];
+	int i, j, first, span;
+
+	huffCodes(len, code);
+	memset(table, 0, sizeof(unsigned short) << HUFF_MAX_BITS);
+	for (i = 0; i < 256; i++) {
+		if (len[i] == 0) continue;
+		span = 1 << (HUFF_MAX_BITS - len[i]);	/* every entry that starts */
+		first = code[i] * span;			/* with the code of i */
+		for (j = 0; j < span; j++) table[first + j] = i << 4 | len[i];
 	}
-	return -1;
 }
 
-//*-----------------------------QUICKSORT ALGORITHM FOR TESTING-----------------------------------*//
-//-------------------------------------------------------------------------------------------------//
-void quickSort(int l, int r)
-{
-   int j;
-
-   if( l < r ) 
-   {
-   	// divide and conquer
-        j = partition(l, r);
-       quickSort(l, j-1);
-       quickSort(j+1, r);
-   }
-	
-}
+int huffEncode(const unsigned char *in, int size, unsigned char *out){
+	unsigned long long freq[256];
 
-int partition(int l, int r) {
-   int i, j, pivot = reps[l], t;
-   char tmp;
-   i = l; j = r+1;
-   printf("%d %d %d\n", l, j, r);
-		
-   while(1)
-   {
-   	do ++i; while( reps[i] <= pivot && i <= r );
-   	do --j; while( reps[j] > pivot );
-   	if( i >= j ) break;
-   	t = reps[i]; reps[i] = reps[j]; reps[j] = t;
-   	tmp = chars[i]; chars[i] = chars[j]; chars[j] = tmp;
-   }
-   t = reps[l]; reps[l] = reps[j]; reps[j] = t;
-   tmp = chars[l]; chars[l] = chars[j]; chars[j] = tmp;
-   return j;
+	huffCount(in, size, freq);
+	return huffEncodeCounted(in, size, freq, out);
 }
-//------------------------------------------------------------------------------------------------//
-//*---------------------------------------END OF QUICKSORT---------------------------------------*//
 
-void printNode(Node * n){
-	printf("v-%d | c-%c | lson-%d | rson-%d\n", n->value, n->ch, (int)n->lson, (int)n->rson);
-}
+int huffEncodeCounted(const unsigned char *in, int size, const unsigned long long freq[256],
+		unsigned char *out){
+	unsigned char len[256];
+	unsigned short code[256];
+	unsigned long long bits = 0, buf = 0;
+	int i, n = 0, pos = HUFF_HEAD + 128;
 
-Node * huffmanTree(char argv[], int size){
-	int i = 0;
-	count(argv, size);
-	//quickSort(0,uniq-1);
-	Node * n;
-	head = createQueue();
-	printf("Text: %d\nUnique: %d\n", size,uniq);
-	for(i=0;i<uniq;i++){
-		n = createNode();
-		n -> value = reps[i];
-		n -> ch = chars[i];
-		push(n);
-		//printf("%c : %d\n", chars[i], reps[i]);
+	out[1] = size;  out[2] = size >> 8;  out[3] = size >> 16;  out[4] = size >> 24;
+	huffLengths(freq, len);
+	for (i = 0; i < 256; i++) bits += freq[i] * len[i];
+	if (size == 0 || 128 + (bits + 7) / 8 >= (unsigned long long) size) {
+		out[0] = 0;  /* stored */
+		memcpy(out + HUFF_HEAD, in, size);
+		return HUFF_HEAD + size;
 	}
-	printQueue();
-	i = 0;
-	Node * n1, * n2;
-	while(!isAlone()){
-		n1 = pop();
-		if(n1 == NULL) break;
-		n2 = pop();
-		if(n2 == NULL) break;
-		n = createNode();
-		n -> lson = n1;
-		n -> rson = n2;
-		n -> value = n1 -> value + n2 -> value;
-		push(n);
+	out[0] = 1;
+	for (i = 0; i < 128; i++) out[HUFF_HEAD + i] = len[2 * i] | len[2 * i + 1] << 4;
+	huffCodes(len, code);
+	for (i = 0; i < size; i++) {  /* the n newest bits of buf are still to go */
+		buf = buf << len[in[i]] | code[in[i]];
+		n += len[in[i]];
+		while (n >= 8) {
+			n -= 8;
+			out[pos++] = (unsigned char) (buf >> n);
+		}
 	}
-	printf("\n\n");
-	char str[1024] = {EOF};
-	printTree(n,str);
-	return n;
+	if (n > 0) out[pos++] = (unsigned char) (buf << (8 - n));
+	return pos;
 }
 
-int end = 0;
+int huffDecodedSize(const unsigned char *in, int size){
+	unsigned int n;
 
-void printTree(Node * n, char str[]){
-	if(n-> lson != NULL) {
-		str[end] = '0';
-		end++;
-		printTree(n->lson, str);
-	}
-	if(n->rson != NULL) {
-		str[end] = '1';
-		end++;
-		printTree(n->rson, str);
-	} 
-	if(n->lson==NULL && n->rson==NULL) {
-		str[end] = '\0';
-		printf("%s : %c : %d bits\n", str, n->ch, end);
-	}
-	end--;
+	if (size < HUFF_HEAD || in[0] > 1) return -1;
+	n = in[1] | in[2] << 8 | in[3] << 16 | (unsigned int) in[4] << 24;
+	if (n > 0x7fffffff) return -1;
+	if (in[0] == 0 ? (unsigned int) size - HUFF_HEAD != n : size < HUFF_HEAD + 128) return -1;
+	return (int) n;
 }
 
-void printQueue(){
-	Queue * q =  head;
-	int i = 0;
-	while(q != NULL){
-		printf("Q: %d %c %d\n", i++, q->n==NULL ? ' ':q->n->ch, q->n==NULL ? 0:q->n->value);
-		q = q->next;
+int huffDecode(const unsigned char *in, int size, unsigned char *out, int limit){
+	unsigned char len[256];
+	unsigned short table[1 << HUFF_MAX_BITS];
+	unsigned long long buf = 0, used = 0, avail;
+	int i, t, n, count = 0, pos = HUFF_HEAD + 128, kraft = 0;
+
+	if ((n = huffDecodedSize(in, size)) < 0) return -1;
+	if (n > limit) n = limit;
+	if (in[0] == 0) {
+		memcpy(out, in + HUFF_HEAD, n);
+		return n;
+	}
+	for (i = 0; i < 128; i++) {
+		len[2 * i] = in[HUFF_HEAD + i] & 15;
+		len[2 * i + 1] = in[HUFF_HEAD + i] >> 4;
 	}
+	for (i = 0; i < 256; i++) {
+		if (len[i] > HUFF_MAX_BITS) return -1;
+		if (len[i]) kraft += 1 << (HUFF_MAX_BITS - len[i]);
+	}
+	if (kraft > 1 << HUFF_MAX_BITS) return -1;  /* not a prefix code */
+	huffTable(len, table);
+	avail = (unsigned long long) (size - pos) * 8;
+	for (i = 0; i < n; i++) {
+		while (count <= 56) {  /* the next count bits are at the top of buf */
+			buf |= (unsigned long long) (pos < size ? in[pos] : 0) << (56 - count);
+			pos++;  count += 8;
+		}
+		t = table[buf >> (64 - HUFF_MAX_BITS)];
+		if ((t & 15) == 0 || (used += t & 15) > avail) return -1;
+		out[i] = t >> 4;
+		buf <<= t & 15;  count -= t & 15;
+	}
+	return n;
 }
-
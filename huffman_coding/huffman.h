@@ -0,0 +1,60 @@
+/* Header file for the Huffman entropy stage
+Include this file in your code and link huffman.c if you want to entropy code a
+buffer, for example the code of an LZSS chunk, to squeeze out what the flags and
+the literals still waste.
+
+A coded buffer is a 5 byte head, the mode and the decoded size (little endian),
+and then either the bytes themselves (mode 0, when coding wouldn't pay off) or
+(mode 1) the 256 code lengths, 4 bits each, and the bits of the canonical codes,
+first bit in the top of the first byte.
+*/
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HUFF_MAX_BITS	15	/* longest code, which is also the decode table's index */
+#define HUFF_HEAD	5
+#define HUFF_BOUND(n)	((n) + HUFF_HEAD)	/* code size of n bytes, at worst stored */
+
+/* The number of times each byte value appears in the size bytes at in. */
+void huffCount(const unsigned char *in, size_t size, unsigned long long freq[256]);
+
+/* Huffman code lengths for freq, none longer than HUFF_MAX_BITS, 0 for the
+values that don't appear. Returns the longest. */
+int huffLengths(const unsigned long long freq[256], unsigned char len[256]);
+
+/* The canonical codes of the lengths: shorter codes first, and values of the
+same length in order. */
+void huffCodes(const unsigned char len[256], unsigned short code[256]);
+
+/* The decode table of the lengths: entry i holds value << 4 | length of the
+code that the top bits of i start with. */
+void huffTable(const unsigned char len[256], unsigned short table[1 << HUFF_MAX_BITS]);
+
+/* Code the size bytes at in into out, which must hold HUFF_BOUND(size) bytes.
+Returns the code size. */
+int huffEncode(const unsigned char *in, int size, unsigned char *out);
+
+/* Same as huffEncode(), with the counts of in already taken, for example on
+the device while in was still there. */
+int huffEncodeCounted(const unsigned char *in, int size, const unsigned long long freq[256],
+		unsigned char *out);
+
+/* The decoded size of the size bytes of code at in, -1 if it can't be code. */
+int huffDecodedSize(const unsigned char *in, int size);
+
+/* Decode the size bytes of code at in into out, writing no more than limit
+bytes. Returns the number of bytes written, or -1 if the code is damaged. */
+int huffDecode(const unsigned char *in, int size, unsigned char *out, int limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif